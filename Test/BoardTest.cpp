@@ -5,6 +5,7 @@
 #include  "../nchess/Memory.h"
 #include <filesystem>
 #include <map>
+#include <random>
 // Test board initializes to standard chess position
 
 
@@ -224,4 +225,219 @@ TEST(BoardTest, PerftPositions) {
 
         EXPECT_EQ(expected_output[0], results[0]);
     }
-}
\ No newline at end of file
+}
+// the bulk counting perft has to agree with the detailed one, with the root split over several threads
+TEST(BoardTest, BulkPerft) {
+    Engine engine;
+    engine.setThreads(4);
+    for (const auto& test : perft_test_data) {
+        std::istringstream fen(test.first);
+        engine.setBoardFEN(fen);
+        for (int depth = 1; depth <= 4; depth++) {
+            EXPECT_EQ(engine.perft(depth), test.second[depth - 1].nodes) << test.first << " depth " << depth;
+        }
+    }
+}
+
+Board boardFromFen(const std::string& fen_str) {
+    Board board;
+    std::istringstream fen(fen_str);
+    board.loadFen(fen);
+    return board;
+}
+
+// plays up to max_plies random legal moves from board. check gets every position on the way, the
+// last one included, along with its legal moves. it may make and undo moves but has to leave the board as it was
+template <typename Check>
+void randomPlayout(Board board, std::mt19937& rng, int max_plies, Check check) {
+    for (int ply = 0; ply < max_plies; ply++) {
+        StaticVector<Move> moves;
+        board.genLegalMoves(moves);
+        check(board, moves);
+        if (moves.empty() || testing::Test::HasFatalFailure()) return;
+        board.doMove(moves[rng() % moves.size()]);
+    }
+}
+
+// the counting fast path has to agree with the generator, including pins, promotions, en passant and mates
+TEST(BoardTest, CountLegalMoves) {
+    std::mt19937 rng(42);
+    std::vector<std::string> fens = {
+        "8/8/8/KPp4r/8/8/8/7k w - c6 0 1",
+        "7k/5Q2/6K1/8/8/8/8/8 b - - 0 1",
+        "7k/6Q1/6K1/8/8/8/8/8 b - - 0 1",
+    };
+    for (const auto& test : perft_test_data) fens.push_back(test.first);
+
+    for (const auto& fen : fens) {
+        for (int game = 0; game < 20; game++) {
+            randomPlayout(boardFromFen(fen), rng, 80, [](Board& board, const StaticVector<Move>& moves) {
+                ASSERT_EQ(board.countLegalMoves(), moves.size()) << board.boardString();
+                ASSERT_EQ(board.hasLegalMove(), !moves.empty()) << board.boardString();
+            });
+            if (HasFatalFailure()) return;
+        }
+    }
+}
+
+// the key used to prefetch the child's tt bucket has to be the one doMove actually produces
+TEST(BoardTest, KeyAfterMatchesDoMove) {
+    std::mt19937 rng(7);
+    for (const auto& test : perft_test_data) {
+        for (int game = 0; game < 20; game++) {
+            randomPlayout(boardFromFen(test.first), rng, 100, [](Board& board, const StaticVector<Move>& moves) {
+                if (moves.empty()) return;
+                for (auto move : moves) {
+                    u64 key = board.keyAfter(move);
+                    board.doMove(move);
+                    ASSERT_EQ(key, board.getHash()) << move.toUci() << "\n" << board.boardString();
+                    board.undoMove();
+                }
+                u64 null_key = board.keyAfter(Move(0, 0));
+                board.doMove(Move(0, 0));
+                ASSERT_EQ(null_key, board.getHash());
+                board.undoMove();
+            });
+            if (HasFatalFailure()) return;
+        }
+    }
+}
+
+// tt moves and killers are validated with isPseudoLegal instead of being generated,
+// so it has to agree with the generator for every possible compact move
+TEST(BoardTest, PseudoLegalMatchesGenerator) {
+    for (const auto& test : perft_test_data) {
+        Board board;
+        std::istringstream fen(test.first);
+        board.loadFen(fen);
+
+        for (int ply = 0; ply < 4; ply++) {
+            StaticVector<Move> moves;
+            board.genPseudoLegalMoves(moves);
+
+            for (u32 compact = 0; compact < (1 << 15); compact++) {
+                Move move = board.moveFromCompact(static_cast<u16>(compact));
+                bool generated = std::ranges::find(moves, move) != moves.end();
+                EXPECT_EQ(board.isPseudoLegal(move), generated) << move.toUci();
+            }
+
+            board.filterToLegal(moves);
+            board.doMove(moves[ply % moves.size()]);
+        }
+    }
+}
+
+// taking en passant removes two pawns from the rank at once and can expose the king
+TEST(BoardTest, EnPassantDiscoveredCheck) {
+    Board board;
+    std::istringstream fen("8/8/8/KPp4r/8/8/8/7k w - c6 0 1");
+    board.loadFen(fen);
+
+    StaticVector<Move> moves;
+    board.genLegalMoves(moves);
+    for (const auto& m : moves) {
+        EXPECT_FALSE(m.isEnPassant()) << m.toUci();
+    }
+}
+
+TEST(BoardTest, StaticExchange) {
+    const std::vector<std::tuple<std::string, std::string, int, bool>> cases = {
+        {"1k1r4/1pp4p/p7/4p3/8/P5P1/1PP4P/2K1R3 w - - 0 1", "e1e5", 0, true},
+        {"1k1r3q/1ppn3p/p4b2/4p3/8/P2N2P1/1PP1R1BP/2K1Q3 w - - 0 1", "d3e5", 0, false},
+        {"1k1r3q/1ppn3p/p4b2/4p3/8/P2N2P1/1PP1R1BP/2K1Q3 w - - 0 1", "d3e5", -220, true},
+        {"4k3/8/2p5/3p4/4P3/8/8/4K3 w - - 0 1", "e4d5", 0, true},
+        {"4k3/8/2p5/3p4/4P3/8/8/4K3 w - - 0 1", "e4d5", 1, false},
+        {"4k3/8/2p5/3p4/4Q3/8/8/4K3 w - - 0 1", "e4d5", 0, false},
+    };
+    for (const auto& [fen_str, move, threshold, expected] : cases) {
+        Board board;
+        std::istringstream fen(fen_str);
+        board.loadFen(fen);
+        EXPECT_EQ(board.see(board.moveFromUCI(move), threshold), expected) << fen_str << " " << move;
+    }
+}
+
+TEST(BoardTest, PassedPawns) {
+    Board board;
+    std::istringstream fen("4k3/7p/8/1P1p4/8/4P3/8/4K3 w - - 0 1");
+    board.loadFen(fen);
+
+    PawnEntry entry;
+    board.evalPawns(entry);
+    EXPECT_EQ(entry.key, board.getPawnHash());
+    EXPECT_EQ(entry.passed[eWhite], BB::set_bit(b5));
+    EXPECT_EQ(entry.passed[eBlack], BB::set_bit(h7));
+}
+
+// a random net, the incrementally updated accumulators have to match a refresh after every
+// move and every backend has to produce the same evals
+TEST(BoardTest, NNUEIncrementalAndBackends) {
+    std::mt19937 rng(1234);
+    std::stringstream net;
+    auto write = [&](auto value) { net.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+    auto write_random = [&]<typename T>(T, int count, int lo, int hi) {
+        std::uniform_int_distribution<int> dist(lo, hi);
+        for (int i = 0; i < count; i++) write(static_cast<T>(dist(rng)));
+    };
+    for (u32 value : { NNUE::magic, NNUE::version, u32(NNUE::hidden), u32(NNUE::l1_size), u32(NNUE::l2_size) }) write(value);
+    write_random(i16(), NNUE::hidden, 0, 60);
+    write_random(i16(), NNUE::features * NNUE::hidden, -20, 20);
+    write_random(i32(), NNUE::l1_size, -500, 500);
+    write_random(i8(), NNUE::l1_size * 2 * NNUE::hidden, -6, 6);
+    write_random(i32(), NNUE::l2_size, -500, 500);
+    write_random(i8(), NNUE::l2_size * NNUE::l1_size, -30, 30);
+    write_random(i32(), 1, -100, 100);
+    write_random(i8(), NNUE::l2_size, -60, 60);
+    // the net is global, a failed assertion must not leave it loaded for the tests after this one
+    struct NetGuard {
+        NNUE::Backend backend = NNUE::getBackend();
+        ~NetGuard() {
+            NNUE::unload();
+            NNUE::setBackend(backend);
+        }
+    } net_guard;
+    ASSERT_TRUE(NNUE::load(net));
+
+    for (const auto& test : perft_test_data) {
+        Board start = boardFromFen(test.first);
+        start.refreshAccumulator();
+        randomPlayout(start, rng, 40, [](Board& board, const StaticVector<Move>&) {
+            Board fresh = board;
+            fresh.refreshAccumulator();
+            std::vector<int> evals;
+            for (NNUE::Backend backend : NNUE::supportedBackends()) {
+                NNUE::setBackend(backend);
+                evals.push_back(board.getEval());
+                EXPECT_EQ(evals.back(), fresh.getEval()) << NNUE::backendName(backend);
+            }
+            EXPECT_TRUE(std::ranges::all_of(evals, [&](int eval) { return eval == evals.front(); }));
+        });
+    }
+
+    // accumulators that outlive the net fall back to the hand written eval
+    Board stale;
+    stale.refreshAccumulator();
+    NNUE::unload();
+    stale.doMove(stale.moveFromSan("e4"));
+    Board plain;
+    plain.doMove(plain.moveFromSan("e4"));
+    EXPECT_EQ(stale.getEval(), plain.getEval());
+}
+
+TEST(BoardTest, Threefold) {
+    Board board;
+    std::istringstream moves("moves g1f3 g8f6 f3g1 f6g8 g1f3 g8f6 f3g1");
+    board.loadUci(moves);
+    EXPECT_FALSE(board.is3fold());
+    board.doMove(board.moveFromUCI("f6g8"));
+    EXPECT_TRUE(board.is3fold());
+    board.undoMove();
+    EXPECT_FALSE(board.is3fold());
+
+    //a pawn move in between resets the count
+    Board reset_board;
+    std::istringstream pawn_moves("moves g1f3 g8f6 f3g1 f6g8 e2e3 e7e6 g1f3 g8f6 f3g1");
+    reset_board.loadUci(pawn_moves);
+    reset_board.doMove(reset_board.moveFromUCI("f6g8"));
+    EXPECT_FALSE(reset_board.is3fold());
+}
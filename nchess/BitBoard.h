@@ -80,6 +80,11 @@ namespace BB {
     inline u64 knight_attacks[64];
 	inline u64 king_attacks[64];
 
+    //squares strictly between two aligned squares, and the full line through them. empty if not aligned
+    inline u64 between[64][64];
+    inline u64 line[64][64];
+    inline void init_rays();
+
     
     inline u64 files[8];
     inline u64 ranks[8];
@@ -464,6 +469,8 @@ namespace BB {
                 magic_db[bishop_magics[square].position + magic_index] = attacks;
             }
         }
+
+        init_rays();
     }
 
     // retrieve attacks for rooks as bitboard
@@ -495,5 +502,35 @@ namespace BB {
             return ((side == eWhite) ? ((pawns & ~BB::files[0]) << 7) : ((pawns & ~BB::files[0]) >> 9)) & occupancy;
         }
     }
-}
 
+    //smear every bit towards the eighth/first rank, the bits themselves included
+    inline u64 north_fill(u64 board) {
+        board |= board << 8;
+        board |= board << 16;
+        return board | (board << 32);
+    }
+
+    inline u64 south_fill(u64 board) {
+        board |= board >> 8;
+        board |= board >> 16;
+        return board | (board >> 32);
+    }
+
+    inline void init_rays() {
+        for (int a = 0; a < 64; a++) {
+            for (int b = 0; b < 64; b++) {
+                between[a][b] = 0;
+                line[a][b] = 0;
+                if (a == b) continue;
+                if (rook_coverage[a] & set_bit(b)) {
+                    line[a][b] = (get_rook_attacks(a, 0) & get_rook_attacks(b, 0)) | set_bit(a) | set_bit(b);
+                    between[a][b] = get_rook_attacks(a, set_bit(b)) & get_rook_attacks(b, set_bit(a));
+                }
+                else if (bishop_coverage[a] & set_bit(b)) {
+                    line[a][b] = (get_bishop_attacks(a, 0) & get_bishop_attacks(b, 0)) | set_bit(a) | set_bit(b);
+                    between[a][b] = get_bishop_attacks(a, set_bit(b)) & get_bishop_attacks(b, set_bit(a));
+                }
+            }
+        }
+    }
+}
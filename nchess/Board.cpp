@@ -2,10 +2,12 @@
 
 
 Board::Board() {
-	state_stack.reserve(512);
 	reset();
 }
 
+Board::Board(const Position& position) : Position(position) {
+}
+
 bool Board::operator==(const Board& other) const {
 	for (int side = 0; side < 2; ++side) {
 		for (int piece = 0; piece < 7; ++piece) {
@@ -45,14 +47,14 @@ void Board::setOccupancy() {
 }
 
 void Board::doMove(Move move) {
-	state_stack.emplace_back(ep_square, castle_flags, move, eval, hash, half_move);
+	state_stack.emplace_back(ep_square, castle_flags, move, psqt, phase, hash, pawn_hash, half_move);
+	rep_filter[hash & (rep_filter_size - 1)]++;
 
 	//null move
 	if (move.from() == move.to()) {
 		us = !us;
 		//update bare minimum zobrist, clear ep square
 		hash ^= z.side;
-		if (state_stack.back().ep_square != -1) hash ^= z.ep_file[state_stack.back().ep_square & 0x7];
 		if (ep_square != -1) hash ^= z.ep_file[ep_square & 0x7];
 
 		// Increment ply count  
@@ -62,6 +64,9 @@ void Board::doMove(Move move) {
 		return;
 	}
 
+	//accumulators left over from a net that has since been unloaded aren't updated, getEval skips them
+	if (!acc_stack.empty() && NNUE::isLoaded()) updateAccumulator(move);
+
 	if (move.piece() == ePawn || move.captured()) {
 		half_move = 0;
 	}
@@ -74,17 +79,13 @@ void Board::doMove(Move move) {
 
 	// Handle promotion  
 	if (move.promotion() != eNone) {
-		boards[us][p] &= ~BB::set_bit(move.to());
-		boards[us][move.promotion()] |= BB::set_bit(move.to());
-		piece_board[move.to()] = move.promotion();
+		removePiece(move.to());
+		setPiece(move.to(), us, move.promotion());
 	}
 
 	// Handle en passant  
 	if (move.isEnPassant()) {
-		u8 ep_capture_square = move.to() + (us == eWhite ? -8 : 8);
-		boards[!us][ePawn] &= ~BB::set_bit(ep_capture_square);
-		boards[!us][0] &= ~BB::set_bit(ep_capture_square);
-		piece_board[ep_capture_square] = eNone;
+		removePiece(move.to() + (us == eWhite ? -8 : 8));
 	}
 
 	if (p == eKing) {
@@ -143,6 +144,59 @@ void Board::doMove(Move move) {
 #endif
 }
 
+void Board::updateAccumulator(Move move) {
+	acc_stack.push_back(acc_stack.back());
+	NNUE::Accumulator& acc = acc_stack.back();
+	const u8 from = move.from();
+	const u8 to = move.to();
+
+	if (move.promotion()) {
+		NNUE::removePiece(acc, us, ePawn, from);
+		NNUE::addPiece(acc, us, move.promotion(), to);
+	}
+	else {
+		NNUE::movePiece(acc, us, move.piece(), from, to);
+	}
+
+	if (move.isEnPassant()) {
+		NNUE::removePiece(acc, !us, ePawn, to + (us == eWhite ? -8 : 8));
+	}
+	else if (move.captured()) {
+		NNUE::removePiece(acc, !us, move.captured(), to);
+	}
+
+	if (move.isCastle()) {
+		switch (to) {
+		case g1: NNUE::movePiece(acc, us, eRook, h1, f1); break;
+		case c1: NNUE::movePiece(acc, us, eRook, a1, d1); break;
+		case g8: NNUE::movePiece(acc, us, eRook, h8, f8); break;
+		case c8: NNUE::movePiece(acc, us, eRook, a8, d8); break;
+		default: break;
+		}
+	}
+}
+
+void Board::refreshAccumulator() {
+	acc_stack.clear();
+	if (!NNUE::isLoaded()) return;
+	acc_stack.reserve(256);
+	acc_stack.push_back(calcAccumulator());
+}
+
+NNUE::Accumulator Board::calcAccumulator() const {
+	NNUE::Accumulator acc;
+	NNUE::clear(acc);
+	unsigned long at = 0;
+	for (int side = eWhite; side <= eBlack; side++) {
+		u64 squares = boards[side][0];
+		while (squares) {
+			BB::bitscan_reset(at, squares);
+			NNUE::addPiece(acc, side, piece_board[at], at);
+		}
+	}
+	return acc;
+}
+
 void Board::undoMove() {
 	if (state_stack.empty()) return;
 	if (BB::popcnt(boards[eBlack][ePawn]) > 8) {
@@ -155,9 +209,12 @@ void Board::undoMove() {
 	us = !us;
 	ep_square = state_stack.back().ep_square;
 	castle_flags = state_stack.back().castle_flags;
-	eval = state_stack.back().eval;
 	hash = state_stack.back().hash;
 	half_move = state_stack.back().half_move;
+	const int prev_psqt = state_stack.back().psqt;
+	const int prev_phase = state_stack.back().phase;
+	const u64 prev_pawn_hash = state_stack.back().pawn_hash;
+	rep_filter[hash & (rep_filter_size - 1)]--;
 	state_stack.pop_back();
 	// Switch side to move back
 
@@ -169,6 +226,8 @@ void Board::undoMove() {
 		return;
 	}
 
+	if (acc_stack.size() > 1) acc_stack.pop_back();
+
 	u8 from = move.from();
 	u8 to = move.to();
 	u8 piece = move.piece();
@@ -208,6 +267,11 @@ void Board::undoMove() {
 		}
 	}
 
+	//the piece helpers above already brought these back, restoring them keeps undo from ever drifting
+	psqt = prev_psqt;
+	phase = prev_phase;
+	pawn_hash = prev_pawn_hash;
+
 #ifndef NDEBUG
 	runSanityChecks();
 #endif
@@ -342,6 +406,16 @@ void Board::movePiece(u8 from, u8 to) {
 		throw std::logic_error("weird");
 	}
 
+	psqt += psqtValue(color, piece_board[from], to) - psqtValue(color, piece_board[from], from);
+	if (piece_board[from] == ePawn) {
+		pawn_hash ^= z.piece_at[from * 12 + (ePawn - 1) + color * 6] ^ z.piece_at[to * 12 + (ePawn - 1) + color * 6];
+	}
+	if (piece_board[to] != eNone) {
+		psqt -= psqtValue(!color, piece_board[to], to);
+		phase -= phase_weight[piece_board[to]];
+		if (piece_board[to] == ePawn) pawn_hash ^= z.piece_at[to * 12 + (ePawn - 1) + !color * 6];
+	}
+
 	boards[color][piece_board[from]] ^= BB::set_bit(from);
 	boards[color][0] ^= BB::set_bit(from);
 	boards[color][piece_board[from]] |= BB::set_bit(to);
@@ -358,6 +432,9 @@ void Board::setPiece(u8 square, u8 color, u8 piece) {
 	boards[color][piece] |= BB::set_bit(square);
 	boards[color][0] |= BB::set_bit(square);
 	piece_board[square] = piece;
+	psqt += psqtValue(color, piece, square);
+	phase += phase_weight[piece];
+	if (piece == ePawn) pawn_hash ^= z.piece_at[square * 12 + (ePawn - 1) + color * 6];
 }
 
 void Board::removePiece(u8 square) {
@@ -365,6 +442,9 @@ void Board::removePiece(u8 square) {
 	if (color != eSideNone) {
 		boards[color][piece_board[square]] &= ~BB::set_bit(square);
 		boards[color][0] &= ~BB::set_bit(square);
+		psqt -= psqtValue(color, piece_board[square], square);
+		phase -= phase_weight[piece_board[square]];
+		if (piece_board[square] == ePawn) pawn_hash ^= z.piece_at[square * 12 + (ePawn - 1) + color * 6];
 	}
 
 	piece_board[square] = eNone;
@@ -451,14 +531,15 @@ void Board::loadFen(std::istringstream& fen_stream) {
 	// Recompute occupancy
 	setOccupancy();
 	hash = calcHash();
-	eval = evalFullUpdate();
+	psqt = calcPsqt();
+	phase = calcPhase();
+	pawn_hash = calcPawnHash();
 	runSanityChecks();
 }
 
 Move Board::moveFromUCI(const std::string& uci) {
 	StaticVector<Move> moves;
-	genPseudoLegalMoves(moves);
-	filterToLegal(moves);
+	genLegalMoves(moves);
 
 	for (const auto& move : moves) {
 		if (move.toUci() == uci) {
@@ -498,7 +579,9 @@ void Board::loadUci(std::istringstream& iss) {
 	}
 	setOccupancy();
 	hash = calcHash();
-	eval = evalFullUpdate();
+	psqt = calcPsqt();
+	phase = calcPhase();
+	pawn_hash = calcPawnHash();
 	runSanityChecks();
 }
 
@@ -506,8 +589,7 @@ Move Board::moveFromSan(const std::string& san) {
 	std::string move = san;
 
 	StaticVector<Move> moves;
-	genPseudoLegalMoves(moves);
-	filterToLegal(moves);
+	genLegalMoves(moves);
 	// Remove check/mate symbols
 	if (!move.empty() && (move.back() == '+' || move.back() == '#'))
 		move.pop_back();
@@ -644,9 +726,7 @@ std::string Board::sanFromMove(Move move) {
 
 	// Handle disambiguation
 	StaticVector<Move> moves;
-	genPseudoLegalMoves(moves);
-
-	filterToLegal(moves);
+	genLegalMoves(moves);
 	bool fileAmbiguity = false, rankAmbiguity = false;
 	for (const auto& m : moves) {
 		if (m.to() == to && m.piece() == piece && m.from() != from) {
@@ -688,6 +768,11 @@ std::string Board::sanFromMove(Move move) {
 }
 
 void Board::genPseudoLegalMoves(StaticVector<Move>& moves) {
+	genPseudoLegalCaptures(moves);
+	genPseudoLegalQuiets(moves);
+}
+
+void Board::genPseudoLegalQuiets(StaticVector<Move>& moves) {
 	const int them = us ^ 1;
 
 	u64 our_occ = boards[us][0];
@@ -705,8 +790,6 @@ void Board::genPseudoLegalMoves(StaticVector<Move>& moves) {
 
 	u64 attacks = single_push;
 
-	genPseudoLegalCaptures(moves);
-
 	while (attacks) {
 		unsigned long to;
 		BB::bitscan_reset(to, attacks);
@@ -853,51 +936,500 @@ void Board::serializeMoves(Piece piece, StaticVector<Move>& moves, bool quiet) {
 }
 
 void Board::filterToLegal(StaticVector<Move>& moves) {
-	//could be made quicker, perhaps only checking pieces between king and attackers
+	if (is3fold() || half_move == 100) {
+		moves.clear();
+		return;
+	}
+	const CheckInfo info = getCheckInfo();
 	int new_i = 0;
-	//bool current_check = isCheck();
 	for (int i = 0; i < moves.size();i++) {
-		Move move = moves[i];
+		if (isLegal(moves[i], info)) {
+			moves[new_i] = moves[i];
+			new_i++;
+		}
+	}
+	moves.resize(new_i);
+}
+
+CheckInfo Board::getCheckInfo() const {
+	CheckInfo info;
+	const u64 our_occ = boards[us][0];
+	const u64 their_occ = boards[!us][0];
+	info.king_sq = BB::bitscan(boards[us][eKing]);
+	info.checkers = getAttackers(info.king_sq, us);
+
+	//sliders that would hit the king through at most our own pieces
+	u64 snipers = (BB::get_rook_attacks(info.king_sq, their_occ) & (boards[!us][eRook] | boards[!us][eQueen]))
+		| (BB::get_bishop_attacks(info.king_sq, their_occ) & (boards[!us][eBishop] | boards[!us][eQueen]));
+	unsigned long sniper;
+	while (snipers) {
+		BB::bitscan_reset(sniper, snipers);
+		u64 blockers = BB::between[info.king_sq][sniper] & (our_occ | their_occ);
+		if (BB::popcnt(blockers) == 1 && (blockers & our_occ)) {
+			info.pinned |= blockers;
+		}
+	}
+
+	if (info.checkers) {
+		//double check leaves nothing but king moves
+		info.target_mask = BB::popcnt(info.checkers) > 1 ? 0
+			: BB::between[info.king_sq][BB::bitscan(info.checkers)] | info.checkers;
+	}
+	return info;
+}
+
+bool Board::isLegal(Move move, const CheckInfo& info) const {
+	const u8 from = move.from();
+	const u8 to = move.to();
+
+	if (move.piece() == eKing) {
 		if (move.isCastle()) {
-			if (getAttackers((move.to() + move.from()) / 2, us)) {
-				//moves.erase(moves.begin() + i);
-				continue;
+			return !info.checkers && !getAttackers((from + to) / 2, us) && !getAttackers(to, us);
+		}
+		//take the king off the board so it can't hide behind itself from a slider
+		return !getAttackers(to, us, getOccupancy() ^ BB::set_bit(from));
+	}
+
+	if (move.isEnPassant()) {
+		//both pawns leave the rank at once, look for a discovered slider attack directly
+		const u8 captured_sq = to + (us == eWhite ? -8 : 8);
+		if (!(info.target_mask & (BB::set_bit(to) | BB::set_bit(captured_sq)))) return false;
+		const u64 occ = getOccupancy() ^ BB::set_bit(from) ^ BB::set_bit(captured_sq) ^ BB::set_bit(to);
+		return !(BB::get_rook_attacks(info.king_sq, occ) & (boards[!us][eRook] | boards[!us][eQueen]))
+			&& !(BB::get_bishop_attacks(info.king_sq, occ) & (boards[!us][eBishop] | boards[!us][eQueen]));
+	}
+
+	if (!(info.target_mask & BB::set_bit(to))) return false;
+	return !(info.pinned & BB::set_bit(from)) || (BB::line[info.king_sq][from] & BB::set_bit(to));
+}
+
+bool Board::isLegal(Move move) const {
+	return isLegal(move, getCheckInfo());
+}
+
+template <class List>
+void Board::serializeLegal(Piece piece, List& moves, u64 target, const CheckInfo& info) const {
+	const u64 all_occ = getOccupancy();
+	u64 attackers = boards[us][piece];
+	unsigned long from;
+	while (attackers) {
+		BB::bitscan_reset(from, attackers);
+		u64 targets = 0;
+		switch (piece) {
+		case eKnight: targets = BB::knight_attacks[from]; break;
+		case eBishop: targets = BB::get_bishop_attacks(from, all_occ); break;
+		case eRook: targets = BB::get_rook_attacks(from, all_occ); break;
+		case eQueen: targets = BB::get_queen_attacks(from, all_occ); break;
+		default: break;
+		}
+		targets &= target & info.target_mask;
+		if (info.pinned & BB::set_bit(from)) {
+			targets &= BB::line[info.king_sq][from];
+		}
+		unsigned long to;
+		while (targets) {
+			BB::bitscan_reset(to, targets);
+			moves.emplace_back({ u8(from), u8(to), piece, piece_board[to] });
+		}
+	}
+}
+
+template <class List>
+void Board::genLegalCaptures(List& moves, const CheckInfo& info) const {
+	const u64 their_occ = boards[!us][0];
+	const u64 pawns = boards[us][ePawn];
+	const int promo_rank = (us == eWhite) ? 6 : 1;
+	const bool double_check = BB::popcnt(info.checkers) > 1;
+
+	auto pawn_ok = [&](int from, int to) {
+		return (info.target_mask & BB::set_bit(to))
+			&& (!(info.pinned & BB::set_bit(from)) || (BB::line[info.king_sq][from] & BB::set_bit(to)));
+		};
+
+	if (!double_check) {
+		u64 left_captures = BB::get_pawn_attacks(eWest, Side(us), pawns, their_occ);
+		u64 right_captures = BB::get_pawn_attacks(eEast, Side(us), pawns, their_occ);
+		unsigned long to;
+		while (left_captures) {
+			BB::bitscan_reset(to, left_captures);
+			int from = to - ((us == eWhite) ? 7 : -9);
+			if (!pawn_ok(from, to)) continue;
+			if ((from >> 3) == promo_rank) {
+				for (int promo = eKnight; promo <= eQueen; ++promo)
+					moves.emplace_back({ u8(from), u8(to), ePawn, piece_board[to], u8(promo) });
+			}
+			else {
+				moves.emplace_back({ u8(from), u8(to), ePawn, piece_board[to] });
 			}
 		}
-		if (is3fold() || half_move == 100) {
-			//moves.erase(moves.begin() + i);
-			continue;
+		while (right_captures) {
+			BB::bitscan_reset(to, right_captures);
+			int from = to - ((us == eWhite) ? 9 : -7);
+			if (!pawn_ok(from, to)) continue;
+			if ((from >> 3) == promo_rank) {
+				for (int promo = eKnight; promo <= eQueen; ++promo)
+					moves.emplace_back({ u8(from), u8(to), ePawn, piece_board[to], u8(promo) });
+			}
+			else {
+				moves.emplace_back({ u8(from), u8(to), ePawn, piece_board[to] });
+			}
 		}
 
-		doMove(move);
-		us ^= 1;
-		bool inCheck = isCheck();
-		us ^= 1;
-		undoMove();
+		if (ep_square != -1) {
+			int ep_from = ep_square + (us == eWhite ? -8 : 8);
+			if ((ep_square & 7) > 0 && (pawns & BB::set_bit(ep_from - 1))) {
+				Move move(u8(ep_from - 1), u8(ep_square), ePawn, ePawn, eNone, true);
+				if (isLegal(move, info)) moves.emplace_back(move);
+			}
+			if ((ep_square & 7) < 7 && (pawns & BB::set_bit(ep_from + 1))) {
+				Move move(u8(ep_from + 1), u8(ep_square), ePawn, ePawn, eNone, true);
+				if (isLegal(move, info)) moves.emplace_back(move);
+			}
+		}
 
-		if (!inCheck) {
-			//i++
-			moves[new_i] = moves[i];
-			new_i++;
-			continue;
+		serializeLegal(eKnight, moves, their_occ, info);
+		serializeLegal(eBishop, moves, their_occ, info);
+		serializeLegal(eRook, moves, their_occ, info);
+		serializeLegal(eQueen, moves, their_occ, info);
+	}
+
+	u64 king_targets = BB::king_attacks[info.king_sq] & their_occ;
+	const u64 occ = getOccupancy() ^ BB::set_bit(info.king_sq);
+	unsigned long to;
+	while (king_targets) {
+		BB::bitscan_reset(to, king_targets);
+		if (!getAttackers(to, us, occ)) {
+			moves.emplace_back({ u8(info.king_sq), u8(to), eKing, piece_board[to] });
+		}
+	}
+}
+
+template <class List>
+void Board::genLegalQuiets(List& moves, const CheckInfo& info) const {
+	const u64 all_occ = getOccupancy();
+	const u64 pawns = boards[us][ePawn];
+	const int forward = (us == eWhite) ? 8 : -8;
+	const int promo_rank = (us == eWhite) ? 6 : 1;
+	const bool double_check = BB::popcnt(info.checkers) > 1;
+
+	auto pawn_ok = [&](int from, int to) {
+		return (info.target_mask & BB::set_bit(to))
+			&& (!(info.pinned & BB::set_bit(from)) || (BB::line[info.king_sq][from] & BB::set_bit(to)));
+		};
+
+	if (!double_check) {
+		u64 single_push = ((us == eWhite) ? (pawns << 8) : (pawns >> 8)) & ~all_occ;
+		u64 double_push = ((us == eWhite) ? ((single_push & BB::ranks[2]) << 8) : ((single_push & BB::ranks[5]) >> 8)) & ~all_occ;
+		unsigned long to;
+		while (single_push) {
+			BB::bitscan_reset(to, single_push);
+			int from = to - forward;
+			if (!pawn_ok(from, to)) continue;
+			if ((from >> 3) == promo_rank) {
+				for (int promo = eKnight; promo <= eQueen; ++promo)
+					moves.emplace_back({ u8(from), u8(to), ePawn, eNone, u8(promo) });
+			}
+			else {
+				moves.emplace_back({ u8(from), u8(to), ePawn });
+			}
+		}
+		while (double_push) {
+			BB::bitscan_reset(to, double_push);
+			int from = to - 2 * forward;
+			if (pawn_ok(from, to)) moves.emplace_back({ u8(from), u8(to), ePawn });
+		}
+
+		serializeLegal(eKnight, moves, ~all_occ, info);
+		serializeLegal(eBishop, moves, ~all_occ, info);
+		serializeLegal(eRook, moves, ~all_occ, info);
+		serializeLegal(eQueen, moves, ~all_occ, info);
+	}
+
+	u64 king_targets = BB::king_attacks[info.king_sq] & ~all_occ;
+	const u64 occ = all_occ ^ BB::set_bit(info.king_sq);
+	unsigned long to;
+	while (king_targets) {
+		BB::bitscan_reset(to, king_targets);
+		if (!getAttackers(to, us, occ)) {
+			moves.emplace_back({ u8(info.king_sq), u8(to), eKing });
+		}
+	}
+
+	//castling, the king may not pass through or land on an attacked square
+	if (!info.checkers) {
+		if (us == eWhite) {
+			if ((castle_flags & wShortCastleFlag) && !(u64(0b01100000) & all_occ) && !getAttackers(f1, us) && !getAttackers(g1, us))
+				moves.emplace_back({ e1, g1, eKing });
+			if ((castle_flags & wLongCastleFlag) && !(u64(0b00001110) & all_occ) && !getAttackers(d1, us) && !getAttackers(c1, us))
+				moves.emplace_back({ e1, c1, eKing });
 		}
 		else {
-			//moves.erase(moves.begin() + i);
+			if ((castle_flags & bShortCastleFlag) && !((u64(0b01100000) << 56) & all_occ) && !getAttackers(f8, us) && !getAttackers(g8, us))
+				moves.emplace_back({ e8, g8, eKing });
+			if ((castle_flags & bLongCastleFlag) && !((u64(0b00001110) << 56) & all_occ) && !getAttackers(d8, us) && !getAttackers(c8, us))
+				moves.emplace_back({ e8, c8, eKing });
 		}
 	}
-	moves.resize(new_i);
 }
 
-bool Board::isLegal(Move move) {
-	StaticVector<Move> vmove;
-	vmove.emplace_back(move);
-	if (move.raw() == 0) return false;
+template <class List>
+void Board::genEvasions(List& moves, const CheckInfo& info) const {
+	const u64 all_occ = getOccupancy();
+
+	//the king can always try to step away, in double check that is all there is
+	u64 king_targets = BB::king_attacks[info.king_sq] & ~boards[us][0];
+	const u64 occ = all_occ ^ BB::set_bit(info.king_sq);
+	unsigned long to;
+	while (king_targets) {
+		BB::bitscan_reset(to, king_targets);
+		if (!getAttackers(to, us, occ)) {
+			moves.emplace_back({ u8(info.king_sq), u8(to), eKing, piece_board[to] });
+		}
+	}
+	if (BB::popcnt(info.checkers) > 1) return;
+
+	//everything else has to capture the checker or land on the ray between it and the king
+	const u64 block = BB::between[info.king_sq][BB::bitscan(info.checkers)];
+	const u64 pawns = boards[us][ePawn];
+	const int forward = (us == eWhite) ? 8 : -8;
+	const int promo_rank = (us == eWhite) ? 6 : 1;
 
-	if (piece_board[move.from()] == move.piece() && piece_board[move.to()] == move.captured()) {
-		filterToLegal(vmove);
-		return !vmove.empty();
+	auto add_pawn_move = [&](int from, int to) {
+		if ((info.pinned & BB::set_bit(from)) && !(BB::line[info.king_sq][from] & BB::set_bit(to))) return;
+		if ((from >> 3) == promo_rank) {
+			for (int promo = eKnight; promo <= eQueen; ++promo)
+				moves.emplace_back({ u8(from), u8(to), ePawn, piece_board[to], u8(promo) });
+		}
+		else {
+			moves.emplace_back({ u8(from), u8(to), ePawn, piece_board[to] });
+		}
+		};
+
+	u64 left_captures = BB::get_pawn_attacks(eWest, Side(us), pawns, info.checkers);
+	u64 right_captures = BB::get_pawn_attacks(eEast, Side(us), pawns, info.checkers);
+	while (left_captures) {
+		BB::bitscan_reset(to, left_captures);
+		add_pawn_move(to - ((us == eWhite) ? 7 : -9), to);
 	}
-	return false;
+	while (right_captures) {
+		BB::bitscan_reset(to, right_captures);
+		add_pawn_move(to - ((us == eWhite) ? 9 : -7), to);
+	}
+
+	if (ep_square != -1) {
+		int ep_from = ep_square + (us == eWhite ? -8 : 8);
+		if ((ep_square & 7) > 0 && (pawns & BB::set_bit(ep_from - 1))) {
+			Move move(u8(ep_from - 1), u8(ep_square), ePawn, ePawn, eNone, true);
+			if (isLegal(move, info)) moves.emplace_back(move);
+		}
+		if ((ep_square & 7) < 7 && (pawns & BB::set_bit(ep_from + 1))) {
+			Move move(u8(ep_from + 1), u8(ep_square), ePawn, ePawn, eNone, true);
+			if (isLegal(move, info)) moves.emplace_back(move);
+		}
+	}
+
+	u64 single_push = ((us == eWhite) ? (pawns << 8) : (pawns >> 8)) & ~all_occ;
+	u64 double_push = ((us == eWhite) ? ((single_push & BB::ranks[2]) << 8) : ((single_push & BB::ranks[5]) >> 8)) & block;
+	single_push &= block;
+	while (single_push) {
+		BB::bitscan_reset(to, single_push);
+		add_pawn_move(to - forward, to);
+	}
+	while (double_push) {
+		BB::bitscan_reset(to, double_push);
+		add_pawn_move(to - 2 * forward, to);
+	}
+
+	serializeLegal(eKnight, moves, info.target_mask, info);
+	serializeLegal(eBishop, moves, info.target_mask, info);
+	serializeLegal(eRook, moves, info.target_mask, info);
+	serializeLegal(eQueen, moves, info.target_mask, info);
+}
+
+template <class List>
+void Board::genLegalMoves(List& moves) const {
+	const CheckInfo info = getCheckInfo();
+	if (info.checkers) {
+		genEvasions(moves, info);
+		return;
+	}
+	genLegalCaptures(moves, info);
+	genLegalQuiets(moves, info);
+}
+
+template <bool first_only>
+int Board::legalMoveCount() const {
+	const CheckInfo info = getCheckInfo();
+	const u64 our_occ = boards[us][0];
+	const u64 their_occ = boards[!us][0];
+	const u64 all_occ = our_occ | their_occ;
+	int count = 0;
+
+	//the king first, in double check it is the only piece that can move
+	u64 king_targets = BB::king_attacks[info.king_sq] & ~our_occ;
+	const u64 occ = all_occ ^ BB::set_bit(info.king_sq);
+	unsigned long to;
+	while (king_targets) {
+		BB::bitscan_reset(to, king_targets);
+		if (!getAttackers(to, us, occ)) {
+			if (first_only) return 1;
+			count++;
+		}
+	}
+	if (BB::popcnt(info.checkers) > 1) return count;
+
+	//pawns that aren't pinned move as a set, a push or capture onto the last rank is four promotions
+	const u64 pawns = boards[us][ePawn];
+	const u64 last_rank = BB::ranks[(us == eWhite) ? 7 : 0];
+	auto pawn_targets = [&](u64 from) {
+		u64 single_push = ((us == eWhite) ? (from << 8) : (from >> 8)) & ~all_occ;
+		u64 double_push = ((us == eWhite) ? ((single_push & BB::ranks[2]) << 8) : ((single_push & BB::ranks[5]) >> 8)) & ~all_occ;
+		return std::array<u64, 4>{ single_push, double_push,
+			BB::get_pawn_attacks(eWest, Side(us), from, their_occ), BB::get_pawn_attacks(eEast, Side(us), from, their_occ) };
+		};
+	auto add_pawn_targets = [&](u64 from, u64 mask) {
+		for (u64 targets : pawn_targets(from)) {
+			targets &= mask;
+			count += BB::popcnt(targets & ~last_rank) + 4 * BB::popcnt(targets & last_rank);
+		}
+		};
+	add_pawn_targets(pawns & ~info.pinned, info.target_mask);
+	u64 pinned_pawns = pawns & info.pinned;
+	unsigned long from;
+	while (pinned_pawns) {
+		BB::bitscan_reset(from, pinned_pawns);
+		add_pawn_targets(BB::set_bit(from), info.target_mask & BB::line[info.king_sq][from]);
+	}
+	if (first_only && count) return 1;
+
+	for (Piece piece : { eKnight, eBishop, eRook, eQueen }) {
+		u64 attackers = boards[us][piece];
+		while (attackers) {
+			BB::bitscan_reset(from, attackers);
+			u64 targets = 0;
+			switch (piece) {
+			case eKnight: targets = BB::knight_attacks[from]; break;
+			case eBishop: targets = BB::get_bishop_attacks(from, all_occ); break;
+			case eRook: targets = BB::get_rook_attacks(from, all_occ); break;
+			case eQueen: targets = BB::get_queen_attacks(from, all_occ); break;
+			default: break;
+			}
+			targets &= ~our_occ & info.target_mask;
+			if (info.pinned & BB::set_bit(from)) {
+				targets &= BB::line[info.king_sq][from];
+			}
+			count += BB::popcnt(targets);
+			if (first_only && count) return 1;
+		}
+	}
+
+	if (ep_square != -1) {
+		int ep_from = ep_square + (us == eWhite ? -8 : 8);
+		if ((ep_square & 7) > 0 && (pawns & BB::set_bit(ep_from - 1))) {
+			count += isLegal(Move(u8(ep_from - 1), u8(ep_square), ePawn, ePawn, eNone, true), info);
+		}
+		if ((ep_square & 7) < 7 && (pawns & BB::set_bit(ep_from + 1))) {
+			count += isLegal(Move(u8(ep_from + 1), u8(ep_square), ePawn, ePawn, eNone, true), info);
+		}
+	}
+	//castling is only legal when the king's step towards the rook is, which was counted already
+	if (first_only) return count ? 1 : 0;
+
+	if (!info.checkers) {
+		if (us == eWhite) {
+			count += (castle_flags & wShortCastleFlag) && !(u64(0b01100000) & all_occ) && !getAttackers(f1, us) && !getAttackers(g1, us);
+			count += (castle_flags & wLongCastleFlag) && !(u64(0b00001110) & all_occ) && !getAttackers(d1, us) && !getAttackers(c1, us);
+		}
+		else {
+			count += (castle_flags & bShortCastleFlag) && !((u64(0b01100000) << 56) & all_occ) && !getAttackers(f8, us) && !getAttackers(g8, us);
+			count += (castle_flags & bLongCastleFlag) && !((u64(0b00001110) << 56) & all_occ) && !getAttackers(d8, us) && !getAttackers(c8, us);
+		}
+	}
+	return count;
+}
+
+int Board::countLegalMoves() const {
+	return legalMoveCount<false>();
+}
+
+bool Board::hasLegalMove() const {
+	return legalMoveCount<true>();
+}
+
+template void Board::genLegalCaptures(StaticVector<Move>&, const CheckInfo&) const;
+template void Board::genLegalCaptures(MoveList&, const CheckInfo&) const;
+template void Board::genLegalQuiets(StaticVector<Move>&, const CheckInfo&) const;
+template void Board::genLegalQuiets(MoveList&, const CheckInfo&) const;
+template void Board::genEvasions(StaticVector<Move>&, const CheckInfo&) const;
+template void Board::genEvasions(MoveList&, const CheckInfo&) const;
+template void Board::genLegalMoves(StaticVector<Move>&) const;
+template void Board::genLegalMoves(MoveList&) const;
+
+bool Board::isPseudoLegal(Move move) const {
+	if (!move) return false;
+	const u8 from = move.from();
+	const u8 to = move.to();
+	const u64 all_occ = getOccupancy();
+
+	if (!(boards[us][0] & BB::set_bit(from)) || (boards[us][0] & BB::set_bit(to))) return false;
+	if (piece_board[from] != move.piece()) return false;
+
+	if (move.piece() == ePawn) {
+		const int forward = (us == eWhite) ? 8 : -8;
+		const bool promo_rank = (from >> 3) == ((us == eWhite) ? 6 : 1);
+		if (promo_rank != (move.promotion() >= eKnight && move.promotion() <= eQueen)) return false;
+		if (!promo_rank && move.promotion()) return false;
+
+		const u64 attacks = BB::get_pawn_attacks(eEast, Side(us), BB::set_bit(from), BB::set_bit(to))
+			| BB::get_pawn_attacks(eWest, Side(us), BB::set_bit(from), BB::set_bit(to));
+		if (move.isEnPassant()) {
+			return to == ep_square && move.captured() == ePawn && attacks;
+		}
+		if (move.captured()) {
+			return move.captured() == piece_board[to] && attacks;
+		}
+		if (all_occ & BB::set_bit(to)) return false;
+		if (to == from + forward) return true;
+		return to == from + 2 * forward
+			&& (from >> 3) == ((us == eWhite) ? 1 : 6)
+			&& !(all_occ & BB::set_bit(from + forward));
+	}
+
+	if (move.promotion() || move.isEnPassant() || move.captured() != piece_board[to]) return false;
+
+	if (move.isCastle()) {
+		if (isCheck()) return false;
+		if (us == eWhite) {
+			if (from != e1) return false;
+			if (to == g1) return (castle_flags & wShortCastleFlag) && !(u64(0b01100000) & all_occ);
+			if (to == c1) return (castle_flags & wLongCastleFlag) && !(u64(0b00001110) & all_occ);
+		}
+		else {
+			if (from != e8) return false;
+			if (to == g8) return (castle_flags & bShortCastleFlag) && !((u64(0b01100000) << 56) & all_occ);
+			if (to == c8) return (castle_flags & bLongCastleFlag) && !((u64(0b00001110) << 56) & all_occ);
+		}
+		return false;
+	}
+
+	u64 targets = 0;
+	switch (move.piece()) {
+	case eKnight: targets = BB::knight_attacks[from]; break;
+	case eBishop: targets = BB::get_bishop_attacks(from, all_occ); break;
+	case eRook: targets = BB::get_rook_attacks(from, all_occ); break;
+	case eQueen: targets = BB::get_queen_attacks(from, all_occ); break;
+	case eKing: targets = BB::king_attacks[from]; break;
+	}
+	return targets & BB::set_bit(to);
+}
+
+Move Board::moveFromCompact(u16 compact) const {
+	const u8 from = compact & 0x3F;
+	const u8 to = (compact >> 6) & 0x3F;
+	const u8 piece = piece_board[from];
+	//a pawn can only reach the ep square by capturing onto it
+	const bool ep = piece == ePawn && to == ep_square;
+	return { from, to, piece, ep ? u8(ePawn) : piece_board[to], u8(compact >> 12), ep };
 }
 
 u64 Board::getAttackers(int square) const {
@@ -905,11 +1437,12 @@ u64 Board::getAttackers(int square) const {
 }
 
 u64 Board::getAttackers(int square, bool side) const {
+	return getAttackers(square, side, getOccupancy());
+}
+
+u64 Board::getAttackers(int square, bool side, u64 all_occ) const {
 	u64 attackers = 0;
-	u64 square_mask = BB::set_bit(square);
 	u64 our_occ = boards[side][0];
-	u64 their_occ = boards[!side][0];
-	u64 all_occ = our_occ | their_occ;
 
 	// Check pawns  
 	int left_capture = (side == eBlack) ? -7 : 9;
@@ -937,54 +1470,140 @@ u64 Board::getAttackers(int square, bool side) const {
 	return attackers;
 }
 
+u64 Board::attackersTo(int square, u64 occupancy) const {
+	const u64 sq = BB::set_bit(square);
+	const u64 queens = getPieceBoard(eQueen);
+	//a pawn attacking the square sits where an opposite colored pawn on it would attack
+	const u64 white_pawns = BB::get_pawn_attacks(eEast, eBlack, sq, boards[eWhite][ePawn]) | BB::get_pawn_attacks(eWest, eBlack, sq, boards[eWhite][ePawn]);
+	const u64 black_pawns = BB::get_pawn_attacks(eEast, eWhite, sq, boards[eBlack][ePawn]) | BB::get_pawn_attacks(eWest, eWhite, sq, boards[eBlack][ePawn]);
+	return white_pawns | black_pawns
+		| (BB::knight_attacks[square] & getPieceBoard(eKnight))
+		| (BB::get_bishop_attacks(square, occupancy) & (getPieceBoard(eBishop) | queens))
+		| (BB::get_rook_attacks(square, occupancy) & (getPieceBoard(eRook) | queens))
+		| (BB::king_attacks[square] & getPieceBoard(eKing));
+}
+
+bool Board::see(Move move, int threshold) const {
+	//promotions and en passant are never treated as losing
+	if (move.promotion() || move.isEnPassant() || move.isCastle()) return threshold <= 0;
+
+	const u8 from = move.from();
+	const u8 to = move.to();
+
+	//swap is how far the side that moved is above the threshold if the exchange stops here
+	int swap = piece_vals[piece_board[to]] - threshold;
+	if (swap < 0) return false;
+	swap = piece_vals[move.piece()] - swap;
+	if (swap <= 0) return true;
+
+	u64 occ = getOccupancy() ^ BB::set_bit(from) ^ BB::set_bit(to);
+	u64 attackers = attackersTo(to, occ);
+	const u64 diagonal = getPieceBoard(eBishop) | getPieceBoard(eQueen);
+	const u64 straight = getPieceBoard(eRook) | getPieceBoard(eQueen);
+	bool side = us;
+	bool result = true;
+
+	while (true) {
+		side = !side;
+		attackers &= occ;
+		const u64 side_attackers = attackers & boards[side][0];
+		if (!side_attackers) break;
+		result = !result;
+
+		//recapture with the least valuable piece, sliders behind it join in
+		u64 least = 0;
+		int piece = ePawn;
+		for (; piece <= eKing; piece++) {
+			least = side_attackers & boards[side][piece];
+			if (least) break;
+		}
+
+		if (piece == eKing) {
+			//the king can only take if nothing is left to take it back
+			return (attackers & boards[!side][0]) ? !result : result;
+		}
+
+		swap = piece_vals[piece] - swap;
+		if (swap < result) break;
+
+		occ ^= least & (~least + 1);
+		if (piece == ePawn || piece == eBishop || piece == eQueen) {
+			attackers |= BB::get_bishop_attacks(to, occ) & diagonal;
+		}
+		if (piece == eRook || piece == eQueen) {
+			attackers |= BB::get_rook_attacks(to, occ) & straight;
+		}
+	}
+	return result;
+}
+
 bool Board::isCheck() const {
 	return getAttackers(BB::bitscan(boards[us][eKing]), us);
 }
 
-int Board::evalUpdate(Move move)  {
+int Board::calcPsqt() const {
 	int out = 0;
-	if (true) {
-		return evalFullUpdate();
+	unsigned long at = 0;
+	for (int side = eWhite; side <= eBlack; side++) {
+		u64 squares = boards[side][0];
+		while (squares) {
+			BB::bitscan_reset(at, squares);
+			out += psqtValue(side, piece_board[at], at);
+		}
 	}
+	return out;
+}
 
-	int16_t game_phase = 24 -
-		BB::popcnt(boards[eWhite][eKnight]) -
-		BB::popcnt(boards[eWhite][eBishop]) -
-		BB::popcnt(boards[eWhite][eRook]) * 2 -
-		BB::popcnt(boards[eWhite][eQueen]) * 4 -
-		BB::popcnt(boards[eBlack][eKnight]) -
-		BB::popcnt(boards[eBlack][eBishop]) -
-		BB::popcnt(boards[eBlack][eRook]) * 2 -
-		BB::popcnt(boards[eBlack][eQueen]) * 4
-		;
-
-	u8 from = move.from();
-	u8 to = move.to();
-	if (us != eWhite) {
-		from ^= 56;
-		to ^= 56;
+u64 Board::calcPawnHash() const {
+	u64 out = 0;
+	unsigned long at = 0;
+	for (int side = eWhite; side <= eBlack; side++) {
+		u64 pawns = boards[side][ePawn];
+		while (pawns) {
+			BB::bitscan_reset(at, pawns);
+			out ^= z.piece_at[at * 12 + (ePawn - 1) + side * 6];
+		}
 	}
+	return out;
+}
 
-	int mg_val = mg_table[move.piece()][from];
-	int eg_val = eg_table[move.piece()][from];
-	int old_val = (mg_val + (game_phase * eg_val - mg_val) / 24);
-
-
-	mg_val = mg_table[move.piece()][to];
-	eg_val = eg_table[move.piece()][to];
-	int new_val = (mg_val + (game_phase * eg_val - mg_val) / 24);
+void Board::evalPawns(PawnEntry& entry) const {
+	const u64 white_pawns = boards[eWhite][ePawn];
+	const u64 black_pawns = boards[eBlack][ePawn];
+	int out = 0;
 
-	int update = new_val - old_val;
+	//count doubled pawns
+	for (int file = 0; file < 8; file++) {
+		out += S(-11, -48) *
+			((BB::popcnt(white_pawns & BB::files[file]) >= 2) -
+			 (BB::popcnt(black_pawns & BB::files[file]) >= 2));
+	}
 
-	out = eval + ((us == eWhite) ? -update : update);
+	//count defenders
+	const u64 white_attacks = BB::get_pawn_attacks(eEast, eWhite, white_pawns, ~0ull) | BB::get_pawn_attacks(eWest, eWhite, white_pawns, ~0ull);
+	const u64 black_attacks = BB::get_pawn_attacks(eEast, eBlack, black_pawns, ~0ull) | BB::get_pawn_attacks(eWest, eBlack, black_pawns, ~0ull);
+	out += S(22, 17) * (BB::popcnt(white_attacks & white_pawns) - BB::popcnt(black_attacks & black_pawns));
 
+	//a pawn is passed when no enemy pawn stands in front of it on its own or a neighboring file
+	const u64 white_front = BB::north_fill(white_pawns << 8);
+	const u64 black_front = BB::south_fill(black_pawns >> 8);
+	const u64 white_blocks = white_front | ((white_front & ~BB::files[7]) << 1) | ((white_front & ~BB::files[0]) >> 1);
+	const u64 black_blocks = black_front | ((black_front & ~BB::files[7]) << 1) | ((black_front & ~BB::files[0]) >> 1);
 
-	int t = evalFullUpdate();
+	entry.key = pawn_hash;
+	entry.score = out;
+	entry.passed = { white_pawns & ~black_blocks, black_pawns & ~white_blocks };
+	entry.attack_spans = { BB::north_fill(white_attacks), BB::south_fill(black_attacks) };
+}
 
+int Board::calcPhase() const {
+	int out = 0;
+	for (int piece = eKnight; piece <= eQueen; piece++) {
+		out += phase_weight[piece] * BB::popcnt(getPieceBoard(Piece(piece)));
+	}
 	return out;
 }
 
-
 void Board::runSanityChecks() const {
 	if (BB::popcnt(boards[eBlack][ePawn]) > 8 || BB::popcnt(boards[eWhite][ePawn]) > 8) {
 		printBitBoards();
@@ -1009,7 +1628,16 @@ void Board::runSanityChecks() const {
 		std::cout << boardString();
 		throw std::logic_error("black bitboard mismatch");
 	}
-
+	if (psqt != calcPsqt() || phase != calcPhase() || pawn_hash != calcPawnHash()) {
+		printBitBoards();
+		std::cout << boardString();
+		throw std::logic_error("incremental eval mismatch");
+	}
+	if (!acc_stack.empty() && NNUE::isLoaded() && acc_stack.back() != calcAccumulator()) {
+		printBitBoards();
+		std::cout << boardString();
+		throw std::logic_error("accumulator mismatch");
+	}
 }
 
 void Board::printMoves() const {
@@ -1054,7 +1682,6 @@ void Board::reset() {
 		piece_board[i] = initial_piece_board[i];
 	}
 
-	eval = 0;
 	ply = 0;
 	hash = 0;
 	half_move = 0;
@@ -1062,10 +1689,15 @@ void Board::reset() {
 	castle_flags = 0b1111;
 	ep_square = -1;
 	state_stack.clear();
+	acc_stack.clear();
+	rep_filter.fill(0);
 
 	//legal_moves.reserve(256);
 	setOccupancy();
 	hash = calcHash();
+	psqt = calcPsqt();
+	phase = calcPhase();
+	pawn_hash = calcPawnHash();
 }
 
 std::vector<Move> Board::getLastMoves(int n_moves) const {
@@ -1085,16 +1717,14 @@ u64 Board::getHash() const {
 	return hash;
 }
 
-bool Board::is3fold() {
-	if (state_stack.size() < half_move || state_stack.empty()) return false;
+bool Board::is3fold() const {
+	if (rep_filter[hash & (rep_filter_size - 1)] < 2) return false;
+
+	//every second entry has the other side to move, and nothing before the last irreversible move can repeat
+	const usize limit = std::min<usize>(half_move, state_stack.size());
 	int counter = 0;
-	for (int i = 1; i <= half_move; i++) {
-		if (state_stack[state_stack.size() - i].hash == hash) {
-			counter++;
-		}
-	}
-	if (counter >= 2) {
-		return true;
+	for (usize i = 2; i <= limit; i += 2) {
+		if (state_stack[state_stack.size() - i].hash == hash && ++counter >= 2) return true;
 	}
 	return false;
 }
@@ -1112,6 +1742,53 @@ u64 Board::calcHash() const {
 	return out_hash;
 }
 
+u64 Board::keyAfter(Move move) const {
+	u64 key = hash ^ z.side;
+	if (ep_square != -1) key ^= z.ep_file[ep_square & 0x7];
+	if (move.from() == move.to()) return key;
+
+	const u8 from = move.from();
+	const u8 to = move.to();
+	const u8 p = move.piece();
+	key ^= z.piece_at[(from * 12) + (p - 1) + (us * 6)];
+	key ^= z.piece_at[(to * 12) + ((move.promotion() != eNone ? move.promotion() : p) - 1) + (us * 6)];
+	if (move.isEnPassant()) {
+		key ^= z.piece_at[((to + (us == eWhite ? -8 : 8)) * 12) + (ePawn - 1) + (!us * 6)];
+	}
+	else if (move.captured() != eNone) {
+		key ^= z.piece_at[(to * 12) + (move.captured() - 1) + (!us * 6)];
+	}
+
+	u8 flags = castle_flags;
+	if (p == eKing) {
+		flags &= (us == eWhite) ? ~(wShortCastleFlag | wLongCastleFlag) : ~(bShortCastleFlag | bLongCastleFlag);
+		if (move.isCastle()) {
+			const u8 rook_from = (to > from) ? to + 1 : to - 2;
+			const u8 rook_to = (from + to) / 2;
+			key ^= z.piece_at[(rook_from * 12) + (eRook - 1) + (us * 6)];
+			key ^= z.piece_at[(rook_to * 12) + (eRook - 1) + (us * 6)];
+		}
+	}
+	//a rook leaving or being taken on its home square, the flag is only ever set with the rook there
+	for (u8 square : { from, to }) {
+		switch (square) {
+		case h1: flags &= ~wShortCastleFlag; break;
+		case a1: flags &= ~wLongCastleFlag; break;
+		case h8: flags &= ~bShortCastleFlag; break;
+		case a8: flags &= ~bLongCastleFlag; break;
+		default: break;
+		}
+	}
+	if (flags != castle_flags) {
+		key ^= z.castle_rights[castle_flags] ^ z.castle_rights[flags];
+	}
+
+	if (p == ePawn && std::abs((int)to - (int)from) == 16) {
+		key ^= z.ep_file[from & 0x7];
+	}
+	return key;
+}
+
 void Board::updateZobrist(Move move) {
 	
 	u8 p = move.piece();
@@ -4,6 +4,8 @@
 #include "BitBoard.h"
 #include "Move.h"
 #include "Tables.h"
+#include "PawnTable.h"
+#include "NNUE.h"
 #include <iostream>
 #include <iomanip>
 #include <io.h>
@@ -27,28 +29,38 @@ static int32_t constexpr MG_SCORE(const int s) {
 }
 static int32_t constexpr EG_SCORE(const int s) { return ((int16_t)((uint16_t)((unsigned)((s)+0x8000) >> 16))); }
 
-inline u64 rnd64()
+constexpr u64 rnd64(u64& state)
 {
-    static u64 i = 69;
-    return (i = (164603309694725029ull * i) % 14738995463583502973ull);
+    return (state = (164603309694725029ull * state) % 14738995463583502973ull);
 }
 
 
 struct BoardState {
     u64 hash = 0;
+    u64 pawn_hash = 0;
     i8 ep_square = -1;
     u8 castle_flags = 0b1111; // 0bKQkq
     Move move;
-    int eval = 0;
+    int psqt = 0;
+    int phase = 0;
     u16 half_move;
 
-    BoardState(int ep_square, u8 castle_flags, Move move, int eval, u64 hash, u16 half_move)
-        : ep_square(ep_square), castle_flags(castle_flags), move(move), eval(eval), hash(hash), half_move(half_move) {
+    BoardState(int ep_square, u8 castle_flags, Move move, int psqt, int phase, u64 hash, u64 pawn_hash, u16 half_move)
+        : hash(hash), pawn_hash(pawn_hash), ep_square(ep_square), castle_flags(castle_flags), move(move), psqt(psqt), phase(phase), half_move(half_move) {
     };
 
     auto operator<=>(const BoardState&) const = default;
 };
 
+// checkers and pins for the side to move, worked out once per node for the legal generators
+struct CheckInfo {
+    u64 checkers = 0;
+    u64 pinned = 0;
+    // squares a non king move has to land on to deal with a check, every square when not in check
+    u64 target_mask = ~0ull;
+    int king_sq = 0;
+};
+
 struct Zobrist {
     std::array<u64, 12 * 64> piece_at;
     u64 side;
@@ -56,40 +68,67 @@ struct Zobrist {
     std::array<u64, 8> ep_file;
 };
 
-class Board
-{
-private:
-    // boards[side][0] = occupancy
-    //256 seems big enough, right?
-    //std::vector<Move> legal_moves;
-    std::array < std::array<u64, 7>, 2 > boards;
-
-    static Zobrist initZobristValues() {
-        Zobrist z;
+constexpr Zobrist initZobristValues() {
+    Zobrist z{};
+    u64 state = 69;
 
-        for (auto& val : z.piece_at) val = rnd64();
-        z.side = rnd64();
-        for (auto& val : z.castle_rights) val = rnd64();
-        for (auto& val : z.ep_file) val = rnd64();
+    for (auto& val : z.piece_at) val = rnd64(state);
+    z.side = rnd64(state);
+    for (auto& val : z.castle_rights) val = rnd64(state);
+    for (auto& val : z.ep_file) val = rnd64(state);
 
-        return z;
-    }
+    return z;
+}
 
-    Zobrist z = initZobristValues();
+// the position itself without any history, small enough to copy around freely. a Board can be
+// built from one when the moves that led to it don't matter
+class Position
+{
+protected:
+    // boards[side][0] = occupancy
+    std::array < std::array<u64, 7>, 2 > boards;
     std::array<u8, 64> piece_board;
-    int eval = 0;
+    // packed S() material + piece square score from white's view, kept up to date by
+    // movePiece/setPiece/removePiece
+    int psqt = 0;
+    // knights and bishops count 1, rooks 2, queens 4
+    int phase = 0;
     u64 hash = 0;
+    // zobrist of the pawns alone, also kept by the piece helpers
+    u64 pawn_hash = 0;
     u8 castle_flags = 0b1111;
     int ep_square = -1; // -1 means no en passant square, ep square represents piece taken
 public:
-    int tunable = 0;
-    std::vector<BoardState> state_stack;
     bool us = eWhite;
     int ply = 0;
     u16 half_move = 0;
+};
+
+static_assert(sizeof(Position) <= 256, "Position should stay within four cache lines");
+
+class Board : public Position
+{
+private:
+    // shared by every board in the process, so hashes agree between threads
+    static constexpr Zobrist z = initZobristValues();
+    // one accumulator per ply since the last refreshAccumulator(), empty while no net is in use
+    std::vector<NNUE::Accumulator> acc_stack;
+    // how many state_stack hashes fall on each slot, a zero or one means the position can't be a threefold.
+    // 16 bits because a long game can put more than 255 of them on one slot, a wrapped count would hide a repetition
+    static constexpr usize rep_filter_size = 512;
+    std::array<u16, rep_filter_size> rep_filter = {};
+
+    void updateAccumulator(Move move);
+public:
+    int tunable = 0;
+    std::vector<BoardState> state_stack;
     Board();
     // Copy constructor
     Board(const Board& other) = default;
+    // starts from position with an empty history
+    explicit Board(const Position& position);
+
+    [[nodiscard]] const Position& position() const { return *this; }
 
     // Equality operator
     bool operator==(const Board& other) const;
@@ -117,15 +156,49 @@ public:
     void loadUci(std::istringstream& uci);
     void genPseudoLegalCaptures(StaticVector<Move>& moves);
     void serializeMoves(Piece piece, StaticVector<Move>& moves, bool quiet);
+    template <class List>
+    void serializeLegal(Piece piece, List& moves, u64 target, const CheckInfo& info) const;
+    // countLegalMoves, or 1 as soon as any move is found when first_only is set
+    template <bool first_only>
+    [[nodiscard]] int legalMoveCount() const;
 
+    void genPseudoLegalQuiets(StaticVector<Move>& moves);
     void genPseudoLegalMoves(StaticVector<Move>& moves);
     void filterToLegal(StaticVector<Move>& pseudo_moves);
-    bool isLegal(Move move);
+
+    [[nodiscard]] CheckInfo getCheckInfo() const;
+    // fully legal generation, nothing is made and unmade to test for check.
+    // instantiated for StaticVector<Move> and the search's MoveList
+    template <class List>
+    void genLegalCaptures(List& moves, const CheckInfo& info) const;
+    template <class List>
+    void genLegalQuiets(List& moves, const CheckInfo& info) const;
+    // only king steps, captures of the checker and blocks on the check ray. in double check only king steps
+    template <class List>
+    void genEvasions(List& moves, const CheckInfo& info) const;
+    template <class List>
+    void genLegalMoves(List& moves) const;
+    // same moves as genLegalMoves, but only counted from the target sets, no list is ever built
+    [[nodiscard]] int countLegalMoves() const;
+    // stops at the first legal move, for mate and stalemate checks
+    [[nodiscard]] bool hasLegalMove() const;
+    // legality of a pseudo legal move, only checks that our king isn't left in check
+    [[nodiscard]] bool isLegal(Move move, const CheckInfo& info) const;
+    [[nodiscard]] bool isLegal(Move move) const;
+    // whether the move could have been generated in this position, used to validate tt moves and killers
+    [[nodiscard]] bool isPseudoLegal(Move move) const;
+    // rebuilds a full move from Move::compact()
+    [[nodiscard]] Move moveFromCompact(u16 compact) const;
 
 
     //get index of all attackers of a square
     [[nodiscard]] u64 getAttackers(int square) const;
     [[nodiscard]] u64 getAttackers(int square, bool side) const;
+    [[nodiscard]] u64 getAttackers(int square, bool side, u64 occupancy) const;
+    // attackers of both colors
+    [[nodiscard]] u64 attackersTo(int square, u64 occupancy) const;
+    // static exchange evaluation, true if the capture sequence on move.to() wins at least threshold
+    [[nodiscard]] bool see(Move move, int threshold) const;
     [[nodiscard]] bool isCheck() const;
 
     [[nodiscard]] u64 getOccupancy() const {
@@ -136,11 +209,22 @@ public:
         return boards[eWhite][piece] | boards[eBlack][piece];
     }
 
-    //incrementally update eval
-    [[nodiscard]] int evalUpdate(Move move) ;
+    static constexpr int phase_weight[7] = { 0, 0, 1, 1, 2, 4, 0 };
 
-    [[nodiscard]] int getEval()  {
-        eval = evalFullUpdate();
+    [[nodiscard]] static int psqtValue(u8 color, u8 piece, u8 square) {
+        if (color == eWhite) square ^= 56;
+        const int value = S(mg_table[piece][square], eg_table[piece][square]);
+        return color == eWhite ? value : -value;
+    }
+
+    //from scratch versions of psqt and phase, only used on setup and to check the incremental ones
+    [[nodiscard]] int calcPsqt() const;
+    [[nodiscard]] int calcPhase() const;
+
+    // pawn_table is the calling thread's, without one the pawn terms are worked out every time
+    [[nodiscard]] int getEval(PawnTable* pawn_table = nullptr) const {
+        if (!acc_stack.empty() && NNUE::isLoaded()) return NNUE::evaluate(acc_stack.back(), us);
+        const int eval = evalFullUpdate(pawn_table);
 	    return us == eWhite ? eval : -eval;
     };
 
@@ -148,78 +232,50 @@ public:
     void runSanityChecks() const;
     void printMoves() const;
     void reset();
+    // starts incremental accumulator updates from the current position if a net is loaded,
+    // stops them otherwise
+    void refreshAccumulator();
+    [[nodiscard]] NNUE::Accumulator calcAccumulator() const;
 
     std::vector<Move> getLastMoves(int n_moves) const;
 
     u64 getHash() const;
-    bool is3fold();
+    // the hash doMove(move) would leave behind, without making the move. null moves included
+    [[nodiscard]] u64 keyAfter(Move move) const;
+    // threefold within the moves since the last capture or pawn move, only looks at positions
+    // with the same side to move
+    [[nodiscard]] bool is3fold() const;
 
     [[nodiscard]] u64 calcHash() const;
+    [[nodiscard]] u64 calcPawnHash() const;
+    [[nodiscard]] u64 getPawnHash() const { return pawn_hash; }
+    // fills entry with the pawn structure terms of the current position
+    void evalPawns(PawnEntry& entry) const;
 
     void updateZobrist(Move move);
 
     int getMobility(bool side) const;
 
-    int evalFullUpdate() {
+    int evalFullUpdate(PawnTable* pawn_table = nullptr) const {
         int out = 0;
 
         //tempo
         out += 30;
 
-        int16_t game_phase = 24 -
-            BB::popcnt(boards[eWhite][eKnight]) -
-            BB::popcnt(boards[eWhite][eBishop]) -
-            BB::popcnt(boards[eWhite][eRook]) * 2 -
-            BB::popcnt(boards[eWhite][eQueen]) * 4 -
-            BB::popcnt(boards[eBlack][eKnight]) -
-            BB::popcnt(boards[eBlack][eBishop]) -
-            BB::popcnt(boards[eBlack][eRook]) * 2 -
-            BB::popcnt(boards[eBlack][eQueen]) * 4
-            ;
-
-        int mg_val = 0;
-        int eg_val = 0;
-        u64 white_squares = boards[eWhite][0];
-        unsigned long at;
-        while (white_squares) {
-            BB::bitscan_reset(at, white_squares);
-            u8 p = piece_board[at];
-            u8 sq = at ^ 56;
-            out += S(mg_table[p][sq], eg_table[p][sq]);
-        }
+        int16_t game_phase = 24 - phase;
 
-        u64 black_squares = boards[eBlack][0];
-        at = 0;
-        while (black_squares) {
-            BB::bitscan_reset(at, black_squares);
-            u8 p = piece_board[at];
-            u8 sq = at;
-            out -= S(mg_table[p][sq], eg_table[p][sq]);
-        }
+        out += psqt;
 
-        //count doubled pawns
-        //count isolated and doubled
-        for (int file = 0; file < 8; file++) {
-            /*
-            if (boards[eWhite][ePawn] & BB::files[file])
-                out -= (boards[eWhite][ePawn] & BB::neighbor_files[file]) ? 0 : 10;
-            if (boards[eBlack][ePawn] & BB::files[file])
-                out += (boards[eBlack][ePawn] & BB::neighbor_files[file]) ? 0 : 10;
-			*/
-            out += S(-11, -48) *
-                ((BB::popcnt(boards[eWhite][ePawn] & BB::files[file]) >= 2) -
-            	 (BB::popcnt(boards[eBlack][ePawn] & BB::files[file]) >= 2));
+        if (pawn_table) {
+            PawnEntry& entry = pawn_table->getEntry(pawn_hash);
+            if (entry.key != pawn_hash) evalPawns(entry);
+            out += entry.score;
+        }
+        else {
+            PawnEntry entry;
+            evalPawns(entry);
+            out += entry.score;
         }
-
-        u64 occ = boards[eBlack][0] | boards[eWhite][0];
-        //count defenders
-        u64 w_east_defenders = BB::get_pawn_attacks(eEast, eWhite, boards[eWhite][ePawn], boards[eWhite][ePawn]);
-        u64 w_west_defenders = BB::get_pawn_attacks(eWest, eWhite, boards[eWhite][ePawn], boards[eWhite][ePawn]);
-        u64 b_east_defenders = BB::get_pawn_attacks(eEast, eBlack, boards[eBlack][ePawn], boards[eBlack][ePawn]);
-        u64 b_west_defenders = BB::get_pawn_attacks(eWest, eBlack, boards[eBlack][ePawn], boards[eBlack][ePawn]);
-        
-        //single defenders
-        out += S(22,17) * (BB::popcnt(w_east_defenders | w_west_defenders) - BB::popcnt(b_east_defenders | b_west_defenders));
 
         //bishop pair
         out += S(33, 110) * ((BB::popcnt(boards[eWhite][eBishop]) == 2) - (BB::popcnt(boards[eBlack][eBishop]) == 2));
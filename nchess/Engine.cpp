@@ -6,8 +6,7 @@ void Engine::perftSearch(int d) {
 
 	if (!d) return;
 	StaticVector<Move> legal_moves;
-	b.genPseudoLegalMoves(legal_moves);
-	b.filterToLegal(legal_moves);
+	b.genLegalMoves(legal_moves);
 
 	if (legal_moves.size() == 0) {
 		perf_values[max_depth - d].checkmates++;
@@ -41,112 +40,162 @@ void Engine::perftSearch(int d) {
 	}
 }
 /**/
-Move Engine::search(int depth) {
-	
-	for (auto& i : pv_table) {
-		for (auto& j : i) {
-			j = Move();
+Engine::~Engine() {
+	if (!worker.joinable()) return;
+	stopSearch();
+	{
+		std::lock_guard lock(worker_mutex);
+		exit_worker = true;
+	}
+	worker_cv.notify_all();
+	worker.join();
+}
+
+void Engine::searchLoop() {
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock lock(worker_mutex);
+			worker_cv.wait(lock, [&] { return exit_worker || search_job; });
+			if (exit_worker) return;
+			job = std::exchange(search_job, nullptr);
+		}
+		job();
+		{
+			std::lock_guard lock(worker_mutex);
+			searching = false;
 		}
+		worker_cv.notify_all();
 	}
+}
 
-	for (int i = 0; i < MAX_PLY; i++) {
-		pv_length[i] = 0;
-	}
+void Engine::startSearch(int depth, std::function<void(Move, Move)> on_done) {
+	waitForSearch();
+	//set here rather than in search() so a stop or ponderhit sent right after go is never lost
+	shared->stop = false;
+	shared->pondering = tc.ponder;
+	{
+		std::lock_guard lock(worker_mutex);
+		searching = true;
+		search_job = [this, depth, on_done = std::move(on_done)] {
+			Move best_move = search(depth);
+			on_done(best_move, getPonderMove(best_move));
+		};
+	}
+	worker_cv.notify_all();
+}
 
-	nodes = 0;
-	start_time = std::clock();
-	start_ply = b.ply;
+void Engine::stopSearch() {
+	shared->stop = true;
+}
 
-	move_vec[0].clear();
-	b.genPseudoLegalMoves(move_vec[0]);
-	b.filterToLegal(move_vec[0]);
-	calcTime();
-	Move best_move = move_vec[0].front();
-	std::vector<std::pair<int, Move>> sorted_moves;
-	for (auto move : move_vec[0]) {
-		sorted_moves.push_back({ -100000, move });
+void Engine::ponderHit() {
+	shared->pondering = false;
+}
+
+Move Engine::getPonderMove(Move best_move) {
+	if (!best_move) return Move();
+	if (completed_line.move == best_move && completed_line.pv.size() >= 2) return completed_line.pv[1];
+
+	//fall back to the tt move of the position after our move
+	Move ponder_move;
+	b.doMove(best_move);
+	TTEntry entry = probeTT(b.getHash());
+	if (entry && entry.best_move) {
+		Move move = b.moveFromCompact(entry.best_move);
+		if (b.isPseudoLegal(move) && b.isLegal(move)) ponder_move = move;
 	}
+	b.undoMove();
+	return ponder_move;
+}
 
-	max_depth = 1;
-	int score = 0;
-	int last_score = -100000;
+void Engine::waitForSearch() {
+	std::unique_lock lock(worker_mutex);
+	worker_cv.wait(lock, [&] { return !searching; });
+}
 
+Move Engine::search(int depth) {
+	//one generation per search, entries from earlier searches stay usable but are replaced first
+	shared->tt.nextGeneration();
+	//the helpers copy the board, accumulators included
+	b.refreshAccumulator();
+	//the helpers' counters are zeroed here rather than on their own threads,
+	//the main thread sums them up from its first iteration on
+	for (auto& helper : helpers) {
+		helper->nodes = 0;
+		helper->tt_probes = 0;
+		helper->tt_hits = 0;
+	}
+	std::vector<std::thread> threads;
+	for (auto& helper : helpers) {
+		helper->b = b;
+		helper->tc = tc;
+		threads.emplace_back([&helper, depth] { helper->iterativeDeepening(depth); });
+	}
 
-	for (max_depth = 1; max_depth < 20; max_depth++) {
+	Move best_move = iterativeDeepening(depth);
 
+	//bestmove can't be sent while pondering or in infinite mode, wait for ponderhit or stop
+	while ((shared->pondering || tc.infinite) && !shared->stop) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
 
-		// Keep searching until we get a score within our window
-		pv_length[0] = 0;
-		int delta = 50;
-		int alpha = last_score - delta;
-		int beta = last_score + delta;
-		
+	shared->stop = true;
+	for (auto& thread : threads) {
+		thread.join();
+	}
 
-		// Keep searching until we get a score within our window
-		while (true) {
-			score = alphaBeta(alpha, beta, max_depth, false);
-			if (checkTime()) break;
-			if (score > alpha && score < beta) break;
-			if (score <= alpha) {
-				alpha = std::max(-100000, alpha - delta);
-				delta *= 2; // Exponentially increase window size
-			}
-			else if (score >= beta) {
-				beta = std::min(100000, beta + delta);
-				delta *= 2; // Exponentially increase window size
-			}
-			if (alpha <= -100000 && beta >= 100000) break;
+	//take the deepest finished iteration from any thread
+	Engine* best_thread = this;
+	for (auto& helper : helpers) {
+		if (helper->completed_depth > best_thread->completed_depth && helper->completed_line.move) {
+			best_thread = helper.get();
 		}
-		
-		
-		int index = 0;
+	}
+	//report the line the move comes from, the ponder move is taken from it too
+	if (best_thread != this) {
+		completed_line = best_thread->completed_line;
+		best_move = completed_line.move;
+		printPV(completed_line, 1, best_thread->completed_depth);
+	}
+	return best_move;
+}
 
-		for (auto& move : sorted_moves) {
+void Engine::setThreads(int num_threads) {
+	helpers.clear();
+	for (int i = 1; i < num_threads; i++) {
+		helpers.emplace_back(std::make_unique<Engine>(shared, i));
+	}
+}
 
-			b.doMove(move.second);
-			if (index == 0) {
-				score = -alphaBeta(-beta, -alpha, max_depth, true);
-			}
-			else {
-				score = -alphaBeta(-alpha - 1, -alpha, max_depth, false);
-				if (alpha < score && score < beta) {
-					score = -alphaBeta(-beta, -alpha, max_depth, true);
-				}
-			}
-			b.undoMove();
-			if (checkTime()) break;
+void Engine::setMultiPV(int lines) {
+	multi_pv = lines;
+}
 
-			move.first = score;
+void Engine::setMoveOverhead(int ms) {
+	move_overhead = ms;
+}
 
+void Engine::setHashSize(usize megabytes) {
+	shared->tt.resize(megabytes);
+	hash_mb = megabytes;
+}
 
-			if (score > alpha) {
-				alpha = score;
-				best_move = move.second;
-				move.first = score;
+int Engine::getThreads() const {
+	return static_cast<int>(helpers.size()) + 1;
+}
 
-				b.doMove(best_move);
-				if (!b.is3fold()) updatePV(b.ply - start_ply - 1, best_move);
-				b.undoMove();
-				if (score >= beta) {
-					score = beta;
-				}
-			}
-			index++;
-		}
-		
-		std::sort(sorted_moves.begin(), sorted_moves.end(), [](const auto& a, const auto& b) { return a.first > b.first;  });
-		last_score = sorted_moves[0].first;
-		if (checkTime()) break;
-		printPV(alpha);
+usize Engine::getHashSize() const {
+	return hash_mb;
+}
 
-	}
-	if (best_move.from() == 0 && best_move.to() == 0) {
-		best_move = pv_table[0][0];
-	}
-	return best_move;
+void Engine::clearHash() {
+	shared->tt.clear();
+	shared->eval_cache.clear();
 }
-/*
-Move Engine::search(int depth) {
+
+void Engine::newGame() {
+	if (!thread_id) clearHash();
 	for (auto& i : history_table) {
 		for (auto& j : i) {
 			for (auto& k : j) {
@@ -154,122 +203,205 @@ Move Engine::search(int depth) {
 			}
 		}
 	}
-	for (auto& i : pv_table) {
-		for (auto& j : i) {
-			j = Move();
-		}
+	for (auto& killers : killer_moves) {
+		killers.fill(Move());
+	}
+	pawn_table.clear();
+	b.reset();
+	for (auto& helper : helpers) {
+		helper->newGame();
+	}
+}
+
+u64 Engine::getNodes() const {
+	u64 total = nodes;
+	for (auto& helper : helpers) {
+		total += helper->nodes;
+	}
+	return total;
+}
+
+u64 Engine::getTTProbes() const {
+	u64 total = tt_probes;
+	for (auto& helper : helpers) {
+		total += helper->tt_probes;
+	}
+	return total;
+}
+
+u64 Engine::getTTHits() const {
+	u64 total = tt_hits;
+	for (auto& helper : helpers) {
+		total += helper->tt_hits;
 	}
+	return total;
+}
 
+double Engine::getTTHitRate() const {
+	const u64 probes = getTTProbes();
+	return probes ? 100.0 * getTTHits() / probes : 0.0;
+}
+
+Move Engine::iterativeDeepening(int depth) {
+	//helpers skip some iterations so that the threads spread out over different depths
+	static constexpr int skip_size[20] = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
+	static constexpr int skip_phase[20] = { 0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7 };
+
+	//pv_table is only read up to pv_length, the moves themselves can stay
 	for (int i = 0; i < MAX_PLY; i++) {
 		pv_length[i] = 0;
 	}
-	pv_moves.clear();
-	nodes = 0;
-	start_time = std::clock();
-	start_ply = b.ply;
-
 
+	//search() has already zeroed the helpers' counters
+	if (!thread_id) {
+		nodes = 0;
+		tt_probes = 0;
+		tt_hits = 0;
+	}
+	completed_depth = 0;
+	completed_line = RootMove();
+	start_time = std::chrono::steady_clock::now();
+	start_ply = b.ply;
 
-	std::vector<Move> legal_moves;
-	b.genPseudoLegalMoves(legal_moves);
-	b.filterToLegal(legal_moves);
-	sortMoves(legal_moves);
+	StaticVector<Move> legal_moves;
+	b.genLegalMoves(legal_moves);
 	calcTime();
-	Move best_move = legal_moves.front();
-	std::vector<std::pair<int, Move>> sorted_moves;
+	//checkmate or stalemate, nothing to search
+	if (legal_moves.empty()) {
+		if (!thread_id) syncPrint(b.isCheck() ? "info depth 0 score mate 0" : "info depth 0 score cp 0");
+		return Move();
+	}
+	root_moves.clear();
 	for (auto move : legal_moves) {
-		sorted_moves.push_back({ -100000, move });
+		if (tc.searchmoves.empty() || std::ranges::find(tc.searchmoves, move.toUci()) != tc.searchmoves.end()) {
+			root_moves.emplace_back(move);
+		}
 	}
-
-	max_depth = 1;
-	//int score = alphaBeta(-100000, 100000, max_depth, false);
-	int score = -100000;
-
-	int delta = 50;
-	for (max_depth = 1 ; max_depth < 32; max_depth++) {
-		//pv_length[0] = 0;
-		// Start with narrow aspiration window
-		int alpha = -100000;
-		int beta = 100000;
-
-		if (max_depth >= 3) {
-			alpha = std::max(-100000, score - delta);
-			beta = std::min(100000, score + delta);
+	//none of the searchmoves are legal here, fall back to all of them
+	if (root_moves.empty()) {
+		for (auto move : legal_moves) {
+			root_moves.emplace_back(move);
 		}
+	}
+	const int depth_limit = depth > 0 ? std::min(depth, MAX_DEPTH) : MAX_DEPTH;
+	const usize lines = std::min<usize>(multi_pv, root_moves.size());
+	int best_move_stability = 0;
 
-		// Keep searching until we get a score within our window
-		while (true) {
-			score = alphaBeta(alpha, beta, max_depth, true);
-			if (checkTime()) break;
-			if (score > alpha && score < beta) break;
-			if (score <= alpha) {
-				alpha = std::max(-100000, alpha - delta);
-				delta *= 2; // Exponentially increase window size
-			}
-			if (score >= beta) {
-				beta = std::min(100000, beta + delta);
-				delta *= 2; // Exponentially increase window size
-			}
-			if (alpha <= -100000 && beta >= 100000) break;
+	for (max_depth = 1; max_depth <= depth_limit; max_depth++) {
+		if (thread_id) {
+			int i = (thread_id - 1) % 20;
+			if (((max_depth + skip_phase[i]) / skip_size[i]) % 2) continue;
 		}
 
+		for (auto& root_move : root_moves) {
+			root_move.previous_score = root_move.score;
+			root_move.nodes = 0;
+		}
 
-		int index = 0;
-
-
-		//score = alphaBeta(alpha, beta, max_depth, true);
-
-		index++;
-
-		/*
-		for (auto& move : sorted_moves) {
-
-			b.doMove(move.second);
-			if (index == 0) {
-				score = -alphaBeta(-beta, -alpha, max_depth, true);
+		//each extra line searches the remaining root moves, the ones already reported stay in front
+		for (usize pv_index = 0; pv_index < lines; pv_index++) {
+			//aspiration window around last iteration's score once it means something
+			const int previous = root_moves[pv_index].previous_score;
+			int delta = 50;
+			int alpha = -100000;
+			int beta = 100000;
+			if (max_depth >= 4 && std::abs(previous) < 99000) {
+				alpha = std::max(-100000, previous - delta);
+				beta = std::min(100000, previous + delta);
 			}
-			else {
-				score = -alphaBeta(-alpha - 1, -alpha, max_depth, false);
-				if (alpha < score && score < beta) {
-					score = -alphaBeta(-beta, -alpha, max_depth, true);
+
+			while (true) {
+				const int score = rootSearch(alpha, beta, max_depth, pv_index);
+				if (checkTime()) break;
+				if (score <= alpha) {
+					beta = (alpha + beta) / 2;
+					alpha = std::max(-100000, alpha - delta);
 				}
+				else if (score >= beta) {
+					beta = std::min(100000, beta + delta);
+				}
+				else {
+					break;
+				}
+				delta *= 2;
 			}
-			b.undoMove();
 			if (checkTime()) break;
+			//the new line may beat ones found before it, keep the reported lines best first
+			std::stable_sort(root_moves.begin(), root_moves.begin() + pv_index + 1, [](const auto& a, const auto& b) {
+				return a.score > b.score;
+			});
+		}
+		if (checkTime()) break;
 
-			move.first = score;
+		//searched moves keep their scores, the ones that failed low go by how much effort they took to refute
+		std::stable_sort(root_moves.begin() + lines, root_moves.end(), [](const auto& a, const auto& b) {
+			return a.score != b.score ? a.score > b.score : a.nodes > b.nodes;
+		});
+		const Move best_move = root_moves[0].move;
+		best_move_stability = (best_move == completed_line.move) ? best_move_stability + 1 : 0;
+		completed_depth = max_depth;
+		completed_line = root_moves[0];
+		if (!thread_id) {
+			for (usize i = 0; i < lines; i++) {
+				printPV(root_moves[i], i + 1, max_depth);
+			}
+		}
+		if (softTimeUp(best_move_stability)) break;
+		//go mate n, stop once a mate in n or less has been found
+		if (tc.mate && root_moves[0].score >= 99999 - (2 * tc.mate - 1)) break;
+	}
+	//stopped before the first iteration finished, the first move still beats no move
+	return completed_line.move ? completed_line.move : root_moves[0].move;
+}
 
+int Engine::rootSearch(int alpha, int beta, int depth, usize pv_index) {
+	nodes.store(nodes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	pv_length[0] = 0;
+	int best = -100000;
 
-			if (score > alpha) {
-				alpha = score;
-				best_move = move.second;
-				move.first = score;
+	for (usize i = pv_index; i < root_moves.size(); i++) {
+		RootMove& root_move = root_moves[i];
+		const u64 nodes_before = nodes.load(std::memory_order_relaxed);
 
-				b.doMove(best_move);
-				if (!b.is3fold()) updatePV(b.ply - start_ply - 1, best_move);
-				b.undoMove();
-				if (score >= beta) {
-					score = beta;
-				}
+		shared->tt.prefetch(b.keyAfter(root_move.move));
+		b.doMove(root_move.move);
+		int score;
+		if (i == pv_index) {
+			score = -alphaBeta(-beta, -alpha, depth - 1, true);
+		}
+		else {
+			score = -alphaBeta(-alpha - 1, -alpha, depth - 1, false);
+			if (alpha < score && score < beta) {
+				score = -alphaBeta(-beta, -alpha, depth - 1, true);
 			}
-			index++;
 		}
+		b.undoMove();
+		root_move.nodes += nodes.load(std::memory_order_relaxed) - nodes_before;
+		if (checkTime()) return best;
 
-		//std::sort(sorted_moves.begin(), sorted_moves.end(), [](const auto& a, const auto& b) { return a.first > b.first;  });
-		if (checkTime()) break;
-		printPV(alpha);
+		best = std::max(best, score);
+		//only the first move and moves that raise alpha get a real score, the rest are just bounds
+		if (i == pv_index || score > alpha) {
+			updatePV(0, root_move.move);
+			root_move.score = score;
+			root_move.pv = getPrincipalVariation();
+		}
+		else {
+			root_move.score = -100000;
+		}
 
+		if (score > alpha) {
+			alpha = score;
+			//the new best move goes to the front of this line, where the next iteration starts
+			std::rotate(root_moves.begin() + pv_index, root_moves.begin() + i, root_moves.begin() + i + 1);
+			if (score >= beta) break;
+		}
 	}
-	if (best_move.from() == 0 && best_move.to() == 0) {
-		best_move = pv_table[0][0];
-	}
-	return best_move;
+	return best;
 }
-*/
-
 
 int Engine::alphaBeta(int alpha, int beta, int depth_left, bool is_pv) {
-	nodes++;
+	nodes.store(nodes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
 	const int search_ply = b.ply - start_ply;
 	pv_length[search_ply] = 0;
 
@@ -281,7 +413,7 @@ int Engine::alphaBeta(int alpha, int beta, int depth_left, bool is_pv) {
 	u64 hash_key = b.getHash();
 	TTEntry entry = probeTT(hash_key);
 
-	if (!is_pv && entry && entry.depth_from_root >= max_depth && entry.depth_left >= depth_left && entry.hash == b.getHash()) {
+	if (!is_pv && entry && entry.depth_left >= depth_left) {
 		if (entry.type == TType::EXACT) return entry.eval;
 		if (entry.type == TType::BETA_CUT && entry.eval >= beta) return entry.eval;
 		if (entry.type == TType::FAIL_LOW && entry.eval <= alpha) return entry.eval;
@@ -292,10 +424,13 @@ int Engine::alphaBeta(int alpha, int beta, int depth_left, bool is_pv) {
 	
 
 
-	if (search_ply >= MAX_PLY - 1) return b.getEval();
+	if (search_ply >= MAX_PLY - 1) return evaluate(entry);
+	//evaluated once per node, in check nothing below looks at it
+	const int static_eval = in_check ? TTEntry::no_eval : evaluate(entry);
 
 	//null move pruning
-	if (!is_pv && depth_left >= 3 && !in_check && (b.getEval() + 50) > beta) {
+	if (!is_pv && depth_left >= 3 && !in_check && (static_eval + 50) > beta) {
+		shared->tt.prefetch(b.keyAfter(Move(0, 0)));
 		b.doMove(Move(0, 0));
 		const int R = 2 + (depth_left / 6);
 		int null_score = -alphaBeta(-beta, -beta + 1, depth_left - 1 - R, false);
@@ -308,31 +443,15 @@ int Engine::alphaBeta(int alpha, int beta, int depth_left, bool is_pv) {
 	bool futility_prune = false;
 
 	if (!in_check && depth_left <= 3 && !is_pv) {
-		int futility_margin = b.getEval() + futility_margins[depth_left];
+		int futility_margin = static_eval + futility_margins[depth_left];
 		futility_prune = (futility_margin <= alpha);
 	}
 
-	move_vec[search_ply].clear();
-	b.genPseudoLegalMoves(move_vec[search_ply]);
-	b.filterToLegal(move_vec[search_ply]);
-
-	// Check for #M
-	if (move_vec[search_ply].empty() && in_check) {
-		return -99999 + b.ply - start_ply;
-	} else if (move_vec[search_ply].empty()) {
-		return 0;
-	}
-
-
-	
-	TType tt_flag = TType::FAIL_LOW;
 	int moves_searched = 0;
-	search_calls++;
-	MoveGen move_gen;
+	MoveGen move_gen(*this, b, entry.best_move, search_ply);
 	bool raised_alpha = false;
-	seen_quiets[search_ply].clear();
-	while (const Move move = move_gen.getNext(*this, b, move_vec[search_ply])) {
-		moves_inspected++;
+	MoveList seen_quiets(quiet_stack);
+	while (const Move move = move_gen.getNext()) {
 		if (checkTime()) return best;
 		int score = 0;
 		bool can_reduce =
@@ -343,21 +462,21 @@ int Engine::alphaBeta(int alpha, int beta, int depth_left, bool is_pv) {
 			!is_pv &&
 			depth_left >= 3;
 
-		b.doMove(move);
 		//futility pruning
-
 		if (futility_prune &&
 			!move.captured() &&
 			!move.promotion() &&
 			!move.isEnPassant() &&
 			!is_pv &&
 			!in_check) {
-			b.undoMove();
-
 			moves_searched++;
 			continue;
 		}
 
+		//the child's bucket loads while the move is made
+		shared->tt.prefetch(b.keyAfter(move));
+		b.doMove(move);
+
 		if (can_reduce) {
 			int R = int(0.5 + std::log(depth_left) * std::log(moves_searched) / 3.0);
 			score = -alphaBeta(-alpha - 1, -alpha, depth_left - 1 - R, false);
@@ -402,23 +521,30 @@ int Engine::alphaBeta(int alpha, int beta, int depth_left, bool is_pv) {
 				malus = std::clamp((int)malus, int(-16383), int(16383));
 				history_table[b.us][move.from()][move.to()] +=
 					bonus - history_table[b.us][move.from()][move.to()] * abs(bonus) / 16383;
-				for (auto& quiet : seen_quiets[search_ply]) {
+				for (usize i = 0; i < seen_quiets.size(); i++) {
+					const Move quiet = seen_quiets[i].move;
 					history_table[b.us][quiet.from()][quiet.to()] += 
 						malus - history_table[b.us][quiet.from()][quiet.to()] * abs(malus) / 16383;
 				}
 			}
 
-			storeTTEntry(b.getHash(), beta, TType::BETA_CUT, depth_left, best_move);
+			storeTTEntry(b.getHash(), beta, static_eval, TType::BETA_CUT, depth_left, best_move);
 			return beta;
 		}
 		if (!move.captured()) {
-			seen_quiets[search_ply].emplace_back(move);
+			seen_quiets.emplace_back(move);
 		}
 	}
+
+	// Check for #M, the picker only hands out legal moves
+	if (!moves_searched) {
+		return in_check ? -99999 + search_ply : 0;
+	}
+
 	if (raised_alpha) {
-		storeTTEntry(b.getHash(), best, TType::EXACT, depth_left, best_move);
+		storeTTEntry(b.getHash(), best, static_eval, TType::EXACT, depth_left, best_move);
 	} else {
-		storeTTEntry(b.getHash(), best, TType::FAIL_LOW, depth_left, best_move);
+		storeTTEntry(b.getHash(), best, static_eval, TType::FAIL_LOW, depth_left, best_move);
 	}
 	return best;
 }
@@ -432,17 +558,29 @@ std::vector<Move> Engine::getPrincipalVariation() const {
 	return pv;
 }
 
-void Engine::printPV(int score) {
-	std::vector<Move> pv = getPrincipalVariation();
-	std::cout << "info score cp " << score << " depth " << max_depth
-		<< " nodes " << nodes
-		<< " nps " << static_cast<int>((1000.0 * nodes) / (1000.0 * (std::clock() - start_time) / CLOCKS_PER_SEC))
+void Engine::printPV(const RootMove& line, int multipv, int depth) {
+	u64 total_nodes = getNodes();
+	std::ostringstream out;
+	out << "info multipv " << multipv;
+	if (std::abs(line.score) > 99000) {
+		//mate scores are 99999 - ply, report them as full moves
+		int mate_ply = 99999 - std::abs(line.score);
+		out << " score mate " << (line.score > 0 ? (mate_ply + 1) / 2 : -(mate_ply + 1) / 2);
+	}
+	else {
+		out << " score cp " << line.score;
+	}
+	out << " depth " << depth
+		<< " nodes " << total_nodes
+		<< " time " << elapsedMs()
+		<< " nps " << total_nodes * 1000 / std::max<i64>(1, elapsedMs())
+		<< " hashfull " << shared->tt.hashfull()
 	    << " pv ";
 
-	for (auto& move : pv) {
-		std::cout << move.toUci() << " ";
+	for (auto& move : line.pv) {
+		out << move.toUci() << " ";
 	}
-	std::cout << std::endl;
+	syncPrint(out.str());
 }
 
 std::string Engine::getPV() {
@@ -450,9 +588,8 @@ std::string Engine::getPV() {
 	std::vector<Move> pv = getPrincipalVariation();
 	if (!pv.empty()) {
 		std::string out = "depth " + std::to_string(max_depth)
-			+ " nodes " + std::to_string(nodes)
-			+ " nps " + std::to_string(static_cast<int>((1000.0 * nodes) / (1000.0 * (std::clock() - start_time) / CLOCKS_PER_SEC)))
-			+ " hash hits " + std::to_string(hash_hits) +
+			+ " nodes " + std::to_string(getNodes())
+			+ " nps " + std::to_string(getNodes() * 1000 / std::max<i64>(1, elapsedMs()))
 			+ " pv ";
 
 		for (auto& move : pv) {
@@ -463,43 +600,101 @@ std::string Engine::getPV() {
 	return "";
 }
 
-void Engine::storeTTEntry(u64 hash_key, int score, TType type, u8 depth_left, Move best) {
-	u64 index = __mulh(hash_key & 0x7FFFFFFFFFFFFFFF, hash_size);
-	if (tt[index].ply <= start_ply || tt[index].depth_left <= depth_left) { //replace
-		tt[index] = TTEntry{ hash_key, score, u8(depth_left), u16(start_ply), u8(max_depth), type, best };
+void Engine::storeTTEntry(u64 hash_key, int score, int static_eval, TType type, u8 depth_left, Move best) {
+	const int ply = b.ply - start_ply;
+	if (score > 99000) score += ply;
+	else if (score < -99000) score -= ply;
+	shared->tt.store(hash_key, score, static_eval, type, depth_left, best.compact());
+}
 
-	}
+TTEntry Engine::probeTT(u64 hash_key) {
+	TTEntry entry = shared->tt.probe(hash_key);
+	tt_probes++;
+	if (!entry) return entry;
+	tt_hits++;
+	const int ply = b.ply - start_ply;
+	if (entry.eval > 99000) entry.eval -= ply;
+	else if (entry.eval < -99000) entry.eval += ply;
+	return entry;
+}
+
+int Engine::evaluate(const TTEntry& entry) {
+	if (entry && entry.static_eval != TTEntry::no_eval) return entry.static_eval;
+
+	const u64 hash_key = b.getHash();
+	int eval = 0;
+	if (shared->eval_cache.probe(hash_key, eval)) return eval;
+	eval = b.getEval(&pawn_table);
+	shared->eval_cache.store(hash_key, eval);
+	return eval;
 }
 
 
+i64 Engine::elapsedMs() const {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
 bool Engine::checkTime() {
-	if ((std::clock() - start_time) > max_time) return true;
-	return false;
+	if (shared->stop.load(std::memory_order_relaxed)) return true;
+	//only the main thread keeps time, helpers are stopped through the shared flag
+	if (thread_id || shared->pondering.load(std::memory_order_relaxed)) return false;
+
+	//checked on every call, so a node limited search stops at the same node every time
+	if (tc.nodes && getNodes() >= tc.nodes) {
+		shared->stop = true;
+		return true;
+	}
+
+	u64 searched = nodes.load(std::memory_order_relaxed);
+	if (searched < next_time_check) return false;
+	next_time_check = searched + time_check_interval;
+
+	if (elapsedMs() < hard_limit) return false;
+	//latch the result so every later check and every helper sees it without reading the clock
+	shared->stop = true;
+	return true;
+}
+
+bool Engine::softTimeUp(int best_move_stability) const {
+	//spend more while the best move keeps changing, less once it has settled
+	static constexpr double stability_scale[] = { 2.0, 1.5, 1.2, 1.0, 0.85, 0.7 };
+	if (thread_id || shared->pondering.load(std::memory_order_relaxed)) return false;
+	double scale = stability_scale[std::min(best_move_stability, 5)];
+	//compared as doubles, an unlimited soft_limit would overflow once scaled
+	return elapsedMs() >= std::min<double>(hard_limit, soft_limit * scale);
 }
 
 void Engine::calcTime() {
+	next_time_check = 0;
+	if (tc.infinite) {
+		soft_limit = hard_limit = std::numeric_limits<i64>::max();
+		return;
+	}
 	if (tc.movetime) {
-		max_time = tc.movetime;
+		soft_limit = hard_limit = std::max(1, tc.movetime - move_overhead);
 		return;
 	}
-	int search_ply = b.ply - start_ply;
-
-	float num_moves = move_vec[search_ply].size();
-	float factor = num_moves / 500.0;
 
-	float total_time = b.us ? tc.btime : tc.wtime;
-	float inc = b.us ? tc.binc : tc.winc;
+	i64 time_left = b.us ? tc.btime : tc.wtime;
+	i64 inc = b.us ? tc.binc : tc.winc;
 
-	if (total_time < inc) {
-		max_time = inc * 0.95;
-	}
-	else {
-		max_time = (total_time * factor) + inc * 0.95;
+	//no clock given, search until stopped
+	if (!time_left && !inc) {
+		soft_limit = hard_limit = std::numeric_limits<i64>::max();
+		return;
 	}
-	//max_time = inc;
+
+	time_left = std::max<i64>(1, time_left - move_overhead);
+	i64 moves_to_go = tc.movestogo ? std::min(tc.movestogo, 40) : 30;
+	soft_limit = time_left / moves_to_go + inc * 3 / 4;
+	//never plan on using most of what is left on the clock
+	hard_limit = std::min(soft_limit * 4, time_left * 4 / 5);
+	soft_limit = std::min(soft_limit, hard_limit);
 }
 
 void Engine::updatePV(int depth, Move move) {
+	//the pv of a ply this deep stays empty, so every row above fits its table row
+	if (depth >= MAX_PV_PLY) return;
 	pv_table[depth][0] = move;
 
 	for (int i = 0; i < pv_length[depth + 1]; i++) {
@@ -509,56 +704,51 @@ void Engine::updatePV(int depth, Move move) {
 }
 
 int Engine::quiesce(int alpha, int beta, bool is_pv) {
-	nodes++;
+	nodes.store(nodes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
 	int search_ply = b.ply - start_ply;
 
-	if (b.is3fold()) return 0;
-
-	int stand_pat = b.getEval();
-	int best = stand_pat;
-
-	//delta prune
-	if (stand_pat < alpha - 950) return alpha;
-
-	if (stand_pat >= beta) return beta;
-
-	if (alpha < stand_pat) {
-		alpha = stand_pat;
-	}
+	if (b.is3fold() || b.half_move == 100) return 0;
 
 	u64 hash_key = b.getHash();
 	TTEntry entry = probeTT(hash_key);
 
-	if (!is_pv && entry && entry.depth_from_root >= max_depth && entry.hash == b.getHash()) {
+	if (!is_pv && entry) {
 		if (entry.type == TType::EXACT) return entry.eval;
 		if (entry.type == TType::BETA_CUT && entry.eval >= beta) return entry.eval;
 		if (entry.type == TType::FAIL_LOW && entry.eval <= alpha) return entry.eval;
 	}
 
+	if (search_ply >= MAX_PLY - 1) return evaluate(entry);
+
+	//no standing pat in check, every evasion gets searched instead
+	const bool in_check = b.isCheck();
+	const int static_eval = in_check ? TTEntry::no_eval : evaluate(entry);
+	int stand_pat = -100000;
+	if (!in_check) {
+		stand_pat = static_eval;
+
+		//delta prune
+		if (stand_pat < alpha - 950) return alpha;
 
-	move_vec[search_ply].clear();
-	b.genPseudoLegalCaptures(move_vec[search_ply]);
-	b.filterToLegal(move_vec[search_ply]);
+		if (stand_pat >= beta) return beta;
 
-	// Check for #M
-	if (!move_vec[search_ply].size()) {
-		b.genPseudoLegalMoves(move_vec[search_ply]);
-		b.filterToLegal(move_vec[search_ply]);
-		if (move_vec[search_ply].empty() && b.isCheck()) {
-			return -99999 + b.ply - start_ply;
-		} else if (move_vec[search_ply].empty()) {
-			return 0;
+		if (alpha < stand_pat) {
+			alpha = stand_pat;
 		}
-		return stand_pat;
 	}
+	int best = stand_pat;
+
 	bool raised_alpha = false;
+	bool any_move = false;
 	Move best_move;
-	MoveGen move_gen;
-	Move move = move_gen.getNext(*this, b, move_vec[search_ply]);
+	MoveGen move_gen(*this, b, entry.best_move, search_ply, true);
+	Move move = move_gen.getNext();
 	while (move.raw()) {
+		any_move = true;
 		if (move.captured() == eKing) return 99999 - (b.ply - start_ply);
 		if (checkTime()) return best;
 
+		shared->tt.prefetch(b.keyAfter(move));
 		b.doMove(move);
 		int score = -quiesce(-beta, -alpha, is_pv);
 		b.undoMove();
@@ -573,15 +763,24 @@ int Engine::quiesce(int alpha, int beta, bool is_pv) {
 		}
 		if (score >= beta) {
 			best_move = move;
-			storeTTEntry(b.getHash(), beta, TType::BETA_CUT, 0, best_move);
+			storeTTEntry(b.getHash(), beta, static_eval, TType::BETA_CUT, 0, best_move);
 			return beta;
 		}
-		move = move_gen.getNext(*this, b, move_vec[search_ply]);
+		move = move_gen.getNext();
+	}
+
+	// Check for #M, in check the picker already tried every legal move
+	if (!any_move) {
+		if (in_check) {
+			return -99999 + search_ply;
+		}
+		return b.hasLegalMove() ? stand_pat : 0;
 	}
+
 	if (raised_alpha) {
-		storeTTEntry(b.getHash(), best, TType::EXACT, 0, best_move);
+		storeTTEntry(b.getHash(), best, static_eval, TType::EXACT, 0, best_move);
 	} else {
-		storeTTEntry(b.getHash(), best, TType::FAIL_LOW, 0, best_move);
+		storeTTEntry(b.getHash(), best, static_eval, TType::FAIL_LOW, 0, best_move);
 	}
 	return best;
 }
@@ -589,15 +788,72 @@ int Engine::quiesce(int alpha, int beta, bool is_pv) {
 std::vector<PerfT> Engine::doPerftSearch(int depth) {
 	perf_values.clear();
 	perf_values.resize(depth);
-	start_time = std::clock();
+	start_time = std::chrono::steady_clock::now();
 	max_depth = depth;
 	perftSearch(depth);
 	// Returns elapsed time in milliseconds
-	std::cout << "search time: " << static_cast<int>(1000.0 * (std::clock() - start_time) / CLOCKS_PER_SEC) << "ms\n\n";
+	std::cout << "search time: " << elapsedMs() << "ms\n\n";
 
 	return perf_values;
 }
 
+namespace {
+	u64 perftCount(Board& b, int depth, PerftTable& table) {
+		//bulk counting, the last ply is never played or even generated
+		if (depth == 1) return b.countLegalMoves();
+		u64 count = 0;
+		if (table.probe(b.getHash(), depth, count)) return count;
+
+		StaticVector<Move> moves;
+		b.genLegalMoves(moves);
+		for (auto move : moves) {
+			b.doMove(move);
+			count += perftCount(b, depth - 1, table);
+			b.undoMove();
+		}
+		table.store(b.getHash(), depth, count);
+		return count;
+	}
+}
+
+u64 Engine::perft(int depth) {
+	start_time = std::chrono::steady_clock::now();
+	StaticVector<Move> root_moves;
+	b.genLegalMoves(root_moves);
+	if (depth <= 0) return 1;
+
+	PerftTable table(perft_hash_mb);
+	std::vector<u64> counts(root_moves.size());
+	std::atomic<usize> next = 0;
+	//each thread works on its own copy of the position, handing out root moves until they run out
+	auto count_moves = [&] {
+		Board board(b.position());
+		for (usize i = next++; i < root_moves.size(); i = next++) {
+			board.doMove(root_moves[i]);
+			counts[i] = depth == 1 ? 1 : perftCount(board, depth - 1, table);
+			board.undoMove();
+		}
+	};
+	std::vector<std::thread> threads;
+	for (usize i = 0; i < helpers.size(); i++) {
+		threads.emplace_back(count_moves);
+	}
+	count_moves();
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	u64 total = 0;
+	for (usize i = 0; i < root_moves.size(); i++) {
+		syncPrint(root_moves[i].toUci() + ": " + std::to_string(counts[i]));
+		total += counts[i];
+	}
+	const i64 ms = elapsedMs();
+	syncPrint("\nNodes searched: " + std::to_string(total) + "\ntime: " + std::to_string(ms)
+		+ "ms, nps: " + std::to_string(total * 1000 / std::max<i64>(1, ms)));
+	return total;
+}
+
 void Engine::setBoardFEN(std::istringstream& fen) {
 	b.loadFen(fen);
 }
@@ -2,31 +2,40 @@
 
 #include "Board.h"
 #include <ctime>
+#include <chrono>
 #include <algorithm>
 #include <unordered_map>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 #include "Memory.h"
+#include "TranspositionTable.h"
 #include "robin_hood.h"
-enum class TType : u8 {
-	INVALID,
-	EXACT,
-	FAIL_LOW,
-	BETA_CUT,
-	BEST
+
+// state shared between the main search and its helper threads
+struct SharedState {
+	TranspositionTable tt;
+	EvalCache eval_cache;
+	std::atomic<bool> stop = false;
+	// set by go ponder, the clock is ignored until ponderhit clears it
+	std::atomic<bool> pondering = false;
 };
 
-struct TTEntry {
-	u64 hash;
-	int eval = 0;
-	u8 depth_left = 0;
-	u16 ply = 0;
-	u8 depth_from_root = 0;
-	TType type = TType::INVALID;
-	Move best_move;
-
-	[[nodiscard]] explicit constexpr operator bool() const {
-		return type != TType::INVALID;
-	}
+struct RootMove {
+	RootMove() = default;
+	explicit RootMove(Move move) : move(move) {}
+
+	Move move;
+	int score = -100000;
+	// score from the iteration before, the center of the aspiration window
+	int previous_score = -100000;
+	// spent below this move in the current iteration, orders the moves that failed low
+	u64 nodes = 0;
+	std::vector<Move> pv;
 };
 
 struct TimeControl {
@@ -35,55 +44,102 @@ struct TimeControl {
 	int winc = 0;
 	int binc = 0;
 	int movetime = 0;
+	int movestogo = 0;
+	bool ponder = false;
+	// search until stop, even after the last iteration
+	bool infinite = false;
+	// 0 means no limit
+	u64 nodes = 0;
+	int mate = 0;
+	// uci strings of the root moves to consider, all legal moves if empty
+	std::vector<std::string> searchmoves;
 };
 
 class Engine
 {
 private:
 
-	int hash_miss;
-	//Move best_move;
-	static constexpr int MAX_PLY = 64;
-	static constexpr u64 hash_size = 32e6 / sizeof(TTEntry);
-	std::array<std::array<Move, MAX_PLY>, MAX_PLY> pv_table;
+	// iteration limit, tt entries store the depth in 8 bits
+	static constexpr int MAX_DEPTH = 250;
+	// plies from the root the search arrays cover, room for the deepest iteration plus quiescence.
+	// lines that run deeper stop at the static eval
+	static constexpr int MAX_PLY = MAX_DEPTH + 32;
+	static constexpr usize default_hash_mb = 32;
+	static constexpr usize perft_hash_mb = 64;
+	// longest pv kept, plies further down still search but the reported line ends there
+	static constexpr int MAX_PV_PLY = 128;
+	std::array<std::array<Move, MAX_PV_PLY>, MAX_PV_PLY> pv_table;
 
 
 	std::array<int, MAX_PLY> pv_length;
-	std::array<std::array<Move, 10>, MAX_PLY> killer_moves;
-	std::vector<TTEntry> tt;
+	std::array<std::array<Move, 2>, MAX_PLY> killer_moves;
+	// the picker lists of every ply, and the quiets each ply has searched so far for the history malus
+	MoveStack move_stack;
+	MoveStack quiet_stack;
+	friend class MoveGen;
+	// per thread, the pawn structure barely changes between neighboring nodes
+	PawnTable pawn_table;
+	std::shared_ptr<SharedState> shared;
+
+	// lazy smp, thread 0 is the main search and owns the helpers
+	int thread_id = 0;
+	std::vector<std::unique_ptr<Engine>> helpers;
+
+	// persistent thread the main engine runs searches on, so the uci loop stays responsive
+	std::thread worker;
+	std::mutex worker_mutex;
+	std::condition_variable worker_cv;
+	std::function<void()> search_job;
+	bool searching = false;
+	bool exit_worker = false;
+	void searchLoop();
 
 
 	// Engine state variables
 	
 	u16 max_depth = 0;
-	int nodes = 0;
-	int current_age = 0;
-	Move root_best;
-
-	float search_calls = 0;
-	float moves_inspected = 0;
-
-	// Timer variables
-	std::clock_t start_time = 0;
-	int max_time = 0;
+	std::atomic<u64> nodes = 0;
+	int multi_pv = 1;
+	// last Hash size asked for, the tt only keeps its bucket count
+	usize hash_mb = default_hash_mb;
+	u16 completed_depth = 0;
+	// best line of the deepest finished iteration
+	RootMove completed_line;
+	// best first once an iteration is done
+	std::vector<RootMove> root_moves;
+
+	// Timer variables, limits are in milliseconds
+	std::chrono::steady_clock::time_point start_time;
+	// soft: don't start another iteration, hard: abort the one running
+	i64 soft_limit = 0;
+	i64 hard_limit = 0;
+	int move_overhead = 10;
+	// the clock is only read once every time_check_interval nodes
+	static constexpr u64 time_check_interval = 2048;
+	u64 next_time_check = 0;
 	std::vector<PerfT> perf_values;
 	int pos_count = 0;
 
 
 	void perftSearch(int depth);
+	Move iterativeDeepening(int depth);
+	// pvs over root_moves from pv_index on, best move moved to the front of the line
+	int rootSearch(int alpha, int beta, int depth, usize pv_index);
 	int alphaBeta(int alpha, int beta, int depth_left, bool is_pv);
 	int quiesce(int alpha, int beta, bool is_pv);
 public:
 
 	std::array<std::array<std::array<int, 64>, 64>, 2> history_table;
-	int hash_hits = 0;
-	std::array<StaticVector<int>, 64> eval_vec;
-	std::array<StaticVector<Move>, 64> seen_quiets;
+	u64 tt_probes = 0;
+	u64 tt_hits = 0;
 	int start_ply = 0;
 	Board b;
 	TimeControl tc;
-	Engine() {
-		tt.resize(hash_size);
+	Engine() : Engine(std::make_shared<SharedState>(), 0) {
+		shared->tt.resize(default_hash_mb);
+		worker = std::thread(&Engine::searchLoop, this);
+	}
+	Engine(std::shared_ptr<SharedState> shared_state, int id) : shared(std::move(shared_state)), thread_id(id) {
 		for (auto& i : history_table) {
 			for (auto& j : i) {
 				for (auto& k : j) {
@@ -92,29 +148,57 @@ public:
 			}
 		}
 	}
-	std::array<StaticVector<Move>, 64> move_vec;
 
 
+	// detailed perft, plays every leaf to also count captures, checks, mates and so on. single threaded
 	std::vector<PerfT> doPerftSearch(int depth);
 	std::vector<PerfT> doPerftSearch(std::string position, int depth);
+	// leaf count only, the last ply is counted in bulk with countLegalMoves. the root moves are split over
+	// the Threads threads, which share a hash of subtree counts. prints each root move's count
+	u64 perft(int depth);
 
 	void setBoardFEN(std::istringstream& fen);
 	void setBoardUCI(std::istringstream& uci);
 
+	~Engine();
+
 	Move search(int depth);
+	// runs search() on the worker thread and hands the best and ponder move to on_done from there
+	void startSearch(int depth, std::function<void(Move, Move)> on_done);
+	void stopSearch();
+	void ponderHit();
+	Move getPonderMove(Move best_move);
+	void waitForSearch();
+	void setThreads(int num_threads);
+	void setMultiPV(int lines);
+	void setMoveOverhead(int ms);
+	void setHashSize(usize megabytes);
+	[[nodiscard]] int getThreads() const;
+	[[nodiscard]] usize getHashSize() const;
+	void clearHash();
+	void newGame();
+	[[nodiscard]] u64 getNodes() const;
+	// tt probes in this search and how many found an entry, all threads. not safe while searching
+	[[nodiscard]] u64 getTTProbes() const;
+	[[nodiscard]] u64 getTTHits() const;
+	[[nodiscard]] double getTTHitRate() const;
 	std::vector<Move> getPrincipalVariation() const;
 
 	std::string getPV();
-	void printPV(int score);
+	void printPV(const RootMove& line, int multipv, int depth);
 
-	void storeTTEntry(u64 hash_key, int score, TType type, u8 depth_left, Move best);
+	void storeTTEntry(u64 hash_key, int score, int static_eval, TType type, u8 depth_left, Move best);
+	// static eval of the current position, taken from the tt entry or the eval cache when either has it
+	int evaluate(const TTEntry& entry);
 
-	TTEntry probeTT(u64 hash_key) const {
-		u64 index = __mulh(hash_key & 0x7FFFFFFFFFFFFFFF, hash_size);
-		return tt[index];
-	}
+	// mate scores are stored relative to the node rather than the root, these two convert
+	TTEntry probeTT(u64 hash_key);
 
+	[[nodiscard]] i64 elapsedMs() const;
+	// stops the search on the hard time limit or the go nodes budget
 	bool checkTime();
+	// true once the iteration budget, scaled by how many iterations the best move has held, is used up
+	bool softTimeUp(int best_move_stability) const;
 	void calcTime();
 
 	void updatePV(int depth, Move move);
@@ -124,72 +208,40 @@ public:
 
 enum class MoveStage {
 	ttMove,
+	genCaptures,
 	captures,
-	history,
-	evals
+	killers,
+	genQuiets,
+	quiets,
+	badCaptures,
+	genEvasions,
+	evasions,
+	done
 };
+
+// hands out legal moves one at a time, best first.
+// each stage is only generated once the previous one runs dry, so a cutoff on the tt move
+// or an early capture never pays for generating quiets
 class MoveGen {
 private:
+	Engine& e;
+	Board& b;
+	// this ply's slice of the engine's move stack. captures go first, losing ones are parked at the
+	// front of it while the good ones are handed out, and quiets are appended behind them
+	MoveList moves;
+	CheckInfo info;
+	usize current = 0;
+	usize bad_captures_end = 0;
 	MoveStage stage = MoveStage::ttMove;
-	bool init = false;
-public:
-
-	Move getNext(Engine& e, Board& b, StaticVector<Move>& moves) {
-		assert(init == (stage == MoveStage::evals));
-
-		if (moves.empty()) {
-			return Move(0, 0);
-		}
-		Move out;
-
-		TTEntry entry = e.probeTT(e.b.getHash());
-
-		if (stage == MoveStage::ttMove) {
-			
-			auto pos_best = std::find(moves.begin(), moves.end(), entry.best_move);
-			if (pos_best != moves.end()) {
-				out = *pos_best;
-				e.hash_hits++;
-				*pos_best = moves.back();
-				moves.pop_back();
-
-				stage = MoveStage::captures;
-				return out;
-			} else {
-				stage = MoveStage::captures;
-			}
-		}
-		
-
-		if (stage == MoveStage::captures && moves.end() != std::find_if(moves.begin(), moves.end(), [](const auto& m) {return m.captured();})) {
-			auto mvv_lva = [](const auto& a, const auto& b) {
-				return piece_vals[a.captured()] * 10 - piece_vals[a.piece()] < piece_vals[b.captured()] * 10 - piece_vals[b.piece()];
-				};
-			auto pos_best = std::ranges::max_element(moves.begin(), moves.end(), mvv_lva);
-			out = *pos_best;
-			*pos_best = moves.back();
-			moves.pop_back();
-			return out;
-		} else if (stage == MoveStage::captures) {
-			stage = MoveStage::history;
-		}
-
-		if (stage == MoveStage::history) {
-			int max = -100000;
-			int index = 0;
+	bool captures_only;
+	Move tt_move;
+	std::array<Move, 2> killers;
+	int killer_index = 0;
 
-			for (int i = 0; i < moves.size(); i++) {
-				int val = e.history_table[b.us][moves[i].from()][moves[i].to()];
-				if (val > max) {
-					max = val;
-					index = i;
-				}
-			}
-			out = moves[index];
-			moves[index] = moves.back();
-			moves.pop_back();
-			return out;
-		}
-		return Move();
-	}
-};
\ No newline at end of file
+	Move pickBest();
+public:
+	// tt_move is Move::compact() from the tt, captures_only is for quiescence and drops losing captures.
+	// in check every evasion is handed out, captures_only or not
+	MoveGen(Engine& e, Board& b, u16 tt_move, int ply, bool captures_only = false);
+	Move getNext();
+};
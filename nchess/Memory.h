@@ -1,110 +1,63 @@
 #pragma once
 #include "Misc.h"
-#include <stack>
+#include "Move.h"
+#include <array>
+#include <vector>
 #include <cassert>
 #include <span>
-template <class PType, class T>
-class TempPtr {
-private:
-	PType* parent = nullptr;
-	usize pos;
-	usize p_size{ 0 };
-public:
-	class Iterator {
-	private:
-		TempPtr* owner;
-		usize index;
-	public:
-		using iterator_category = std::forward_iterator_tag;
-		using value_type = T;
-		using difference_type = std::ptrdiff_t;
-		using pointer = T*;
-		using reference = T&;
-
-		Iterator(TempPtr* owner, usize index) : owner(owner), index(index) {}
 
-		reference operator*() { return (((*(owner->parent))[index])); }
-		pointer operator->() { return &(operator*()); }
-
-		Iterator& operator++() { ++index; return *this; }
-		Iterator operator++(int) { Iterator tmp = *this; ++index; return tmp; }
+// a move and its ordering score, what the search move stack holds
+struct ScoredMove {
+	Move move;
+	int score = 0;
+};
 
-		bool operator==(const Iterator& other) const { return index == other.index; }
-		bool operator!=(const Iterator& other) const { return !(*this == other); }
-	};
+// one contiguous stack per search thread that every ply pushes its moves onto and pops them off again,
+// so only as much memory as the current line needs is ever touched. grows when a line runs deep
+class MoveStack {
+private:
+	std::vector<ScoredMove> arr;
+	usize top = 0;
+	friend class MoveList;
+public:
+	explicit MoveStack(usize capacity = 1024) : arr(capacity) {}
+	[[nodiscard]] usize size() const { return top; }
+};
 
+// the moves of one ply, everything from where the stack top was when the list was made.
+// the space is handed back when the list goes out of scope, so lists have to die in reverse order,
+// which the recursion gives for free. children pop whatever they pushed before the list grows again
+class MoveList {
+private:
+	MoveStack& stack;
+	usize start;
+public:
+	explicit MoveList(MoveStack& stack) : stack(stack), start(stack.top) {}
+	~MoveList() { stack.top = start; }
+	MoveList(const MoveList&) = delete;
+	MoveList& operator=(const MoveList&) = delete;
 
-	TempPtr(PType* parent, usize pos) : parent(parent), pos(pos) {};
-	~TempPtr() {
-		parent->popPtr();
-	}
-	inline auto operator[](usize i) -> T& {
-		assert(i < p_size);
-		return (*parent)[pos + i];
-	};
-	inline T& front() {
-		return (*parent)[pos];
-	}
-	inline void emplace_back(const T& val) {
-		assert(p_size < parent->max_size());
-		parent->push(val);
-		++p_size;
-	}
-	inline T pop_back() {
-		assert(p_size > 0);
-		--p_size;
-		return std::move(parent->pop_back());
+	inline auto operator[](usize i) -> ScoredMove& {
+		assert(start + i < stack.top);
+		return stack.arr[start + i];
 	}
-	inline void resize(int new_size) {
-		p_size= new_size;
+	inline void emplace_back(const Move& move) {
+		if (stack.top == stack.arr.size()) stack.arr.resize(stack.arr.size() * 2);
+		stack.arr[stack.top++] = { move, 0 };
 	}
 	inline usize size() const {
-		return p_size;
-	}
-	inline bool empty() const {
-		return (p_size == 0);
+		return stack.top - start;
 	}
-
-	// Range-based for loop support
-	Iterator begin()  { return Iterator(this, 0); }
-	Iterator end()  { return Iterator(this, p_size); }
-};
-
-template <class T, usize Capacity>
-class SearchArray {
-private:
-	std::array<T, Capacity> arr{};
-	std::stack<usize> pos_arr;
-	usize d_size{ 0 };
-
-
-public:
-	explicit operator T*() const { return &arr; }
-	inline auto operator[](usize i) -> T& {
-		assert(i < d_size);
-		return arr[i];
-	};
-	inline T pop_back() {
-		return std::move(arr[--d_size]);
-	}
-	inline void push(const T& val) {
-		assert(d_size < Capacity);
-		arr[d_size] = T();
-		arr[d_size++] = std::move(val);
+	inline void resize(usize size) {
+		assert(size <= this->size());
+		stack.top = start + size;
 	}
-	TempPtr<SearchArray, T> getPtr() {
-		pos_arr.push(d_size);
-		return { this, d_size };
+	inline bool empty() const {
+		return stack.top == start;
 	}
-	void popPtr() {
-		if (pos_arr.empty()) {
-			d_size = 0;
-			return;
-		}
-		d_size = pos_arr.top();
-		pos_arr.pop();
+	inline void clear() {
+		stack.top = start;
 	}
-	constexpr usize max_size() { return arr.max_size(); }
 };
 
 template <class T>
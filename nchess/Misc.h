@@ -2,16 +2,26 @@
 #include <cstdint>
 #include <string>
 #include <cstddef>
+#include <iostream>
+#include <mutex>
 
 using u64 = uint64_t;
 using u32 = uint32_t;
 using u16 = uint16_t;
 using i64 = int64_t;
 using i32 = int32_t;
+using i16 = int16_t;
 using u8 = uint8_t;
 using i8 = int8_t;
 using usize = std::size_t;
 
+// the search thread and the uci loop both write to stdout, whole lines go out under one lock
+inline std::mutex cout_mutex;
+inline void syncPrint(const std::string& line) {
+	std::lock_guard lock(cout_mutex);
+	std::cout << line << std::endl;
+}
+
 
 
 
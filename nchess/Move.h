@@ -76,6 +76,9 @@ public:
 
 	[[nodiscard]] uint32_t raw() const { return data; }
 
+	// from, to and promotion packed into 16 bits, enough to identify the move in a position
+	[[nodiscard]] u16 compact() const { return static_cast<u16>((data & 0xFFF) | (promotion() << 12)); }
+
 	[[nodiscard]] constexpr bool operator==(const Move& other) const {
 		return data == other.data;
 	}
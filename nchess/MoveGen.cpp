@@ -1 +1,132 @@
 #include "MoveGen.h"
+
+MoveGen::MoveGen(Engine& e, Board& b, u16 tt_move, int ply, bool captures_only)
+	: e(e), b(b), moves(e.move_stack), info(b.getCheckInfo()), captures_only(captures_only) {
+	if (tt_move) {
+		//the tt move comes from another position on a key collision, check it before trusting it
+		Move move = b.moveFromCompact(tt_move);
+		if ((!captures_only || info.checkers || move.captured()) && b.isPseudoLegal(move)) {
+			this->tt_move = move;
+		}
+	}
+	if (!captures_only) {
+		killers = { e.killer_moves[ply][0], e.killer_moves[ply][1] };
+		if (killers[1] == killers[0]) killers[1] = Move();
+	}
+}
+
+// selection step, only the part of the list that actually gets searched is ever sorted
+Move MoveGen::pickBest() {
+	usize best = current;
+	for (usize i = current + 1; i < moves.size(); i++) {
+		if (moves[i].score > moves[best].score) best = i;
+	}
+	std::swap(moves[current], moves[best]);
+	return moves[current++].move;
+}
+
+Move MoveGen::getNext() {
+	switch (stage) {
+	case MoveStage::ttMove:
+		stage = info.checkers ? MoveStage::genEvasions : MoveStage::genCaptures;
+		if (tt_move && b.isLegal(tt_move, info)) {
+			return tt_move;
+		}
+		return getNext();
+
+	case MoveStage::genCaptures:
+		moves.clear();
+		b.genLegalCaptures(moves, info);
+		//mvv-lva
+		for (usize i = 0; i < moves.size(); i++) {
+			const Move move = moves[i].move;
+			moves[i].score = piece_vals[move.captured()] * 10 - piece_vals[move.piece()];
+		}
+		current = 0;
+		stage = MoveStage::captures;
+		[[fallthrough]];
+
+	case MoveStage::captures:
+		while (current < moves.size()) {
+			Move move = pickBest();
+			if (move == tt_move) continue;
+			if (b.see(move, 0)) return move;
+			//losing captures wait until after the quiets, quiescence doesn't search them at all
+			if (!captures_only) moves[bad_captures_end++].move = move;
+		}
+		if (captures_only) {
+			stage = MoveStage::done;
+			return Move();
+		}
+		stage = MoveStage::killers;
+		[[fallthrough]];
+
+	case MoveStage::killers:
+		while (killer_index < 2) {
+			Move killer = killers[killer_index++];
+			if (killer && killer != tt_move && b.isPseudoLegal(killer) && b.isLegal(killer, info)) return killer;
+		}
+		stage = MoveStage::genQuiets;
+		[[fallthrough]];
+
+	case MoveStage::genQuiets:
+		moves.resize(bad_captures_end);
+		b.genLegalQuiets(moves, info);
+		for (usize i = bad_captures_end; i < moves.size(); i++) {
+			const Move move = moves[i].move;
+			moves[i].score = e.history_table[b.us][move.from()][move.to()] + (move.promotion() == eQueen ? 100000 : 0);
+		}
+		//insertion sort, quiet lists are short and usually close to sorted already
+		for (usize i = bad_captures_end + 1; i < moves.size(); i++) {
+			const ScoredMove move = moves[i];
+			usize j = i;
+			for (; j > bad_captures_end && moves[j - 1].score < move.score; j--) {
+				moves[j] = moves[j - 1];
+			}
+			moves[j] = move;
+		}
+		current = bad_captures_end;
+		stage = MoveStage::quiets;
+		[[fallthrough]];
+
+	case MoveStage::quiets:
+		while (current < moves.size()) {
+			Move move = moves[current++].move;
+			if (move != tt_move && move != killers[0] && move != killers[1]) return move;
+		}
+		current = 0;
+		stage = MoveStage::badCaptures;
+		[[fallthrough]];
+
+	case MoveStage::badCaptures:
+		if (current < bad_captures_end) return moves[current++].move;
+		stage = MoveStage::done;
+		break;
+
+	case MoveStage::genEvasions:
+		moves.clear();
+		b.genEvasions(moves, info);
+		//captures of the checker first, then quiet evasions by history
+		for (usize i = 0; i < moves.size(); i++) {
+			const Move move = moves[i].move;
+			moves[i].score = move.captured()
+				? (1 << 20) + piece_vals[move.captured()] * 10 - piece_vals[move.piece()]
+				: e.history_table[b.us][move.from()][move.to()];
+		}
+		current = 0;
+		stage = MoveStage::evasions;
+		[[fallthrough]];
+
+	case MoveStage::evasions:
+		while (current < moves.size()) {
+			Move move = pickBest();
+			if (move != tt_move) return move;
+		}
+		stage = MoveStage::done;
+		break;
+
+	case MoveStage::done:
+		break;
+	}
+	return Move();
+}
@@ -0,0 +1,354 @@
+#include "NNUE.h"
+#include <algorithm>
+#include <fstream>
+#include <memory>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define NNUE_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+// msvc lets any function use any intrinsic
+#define NNUE_TARGET(arch)
+#else
+#define NNUE_TARGET(arch) __attribute__((target(arch)))
+#endif
+#endif
+
+namespace {
+	using namespace NNUE;
+
+	struct Network {
+		std::vector<i16> ft_biases = std::vector<i16>(hidden);
+		std::vector<i16> ft_weights = std::vector<i16>(features * hidden);
+		std::vector<i32> l1_biases = std::vector<i32>(l1_size);
+		std::vector<i8> l1_weights = std::vector<i8>(l1_size * 2 * hidden);
+		std::vector<i32> l2_biases = std::vector<i32>(l2_size);
+		std::vector<i8> l2_weights = std::vector<i8>(l2_size * l1_size);
+		i32 output_bias = 0;
+		std::vector<i8> output_weights = std::vector<i8>(l2_size);
+	};
+
+	std::unique_ptr<Network> net;
+
+	// everything that scales with the layer sizes, one set per instruction set
+	struct Kernels {
+		void (*add)(i16* acc, const i16* column);
+		void (*sub)(i16* acc, const i16* column);
+		void (*addSub)(i16* acc, const i16* add, const i16* sub);
+		// clips hidden first layer outputs into u8 activations
+		void (*activate)(const i16* in, u8* out);
+		// out[o] = biases[o] + in . weights[o], in_size is a multiple of 32
+		void (*dense)(const u8* in, const i8* weights, const i32* biases, i32* out, int in_size, int out_size);
+	};
+
+	namespace scalar {
+		void add(i16* acc, const i16* column) {
+			for (int i = 0; i < hidden; i++) acc[i] += column[i];
+		}
+
+		void sub(i16* acc, const i16* column) {
+			for (int i = 0; i < hidden; i++) acc[i] -= column[i];
+		}
+
+		void addSub(i16* acc, const i16* add, const i16* sub) {
+			for (int i = 0; i < hidden; i++) acc[i] += add[i] - sub[i];
+		}
+
+		void activate(const i16* in, u8* out) {
+			for (int i = 0; i < hidden; i++) out[i] = static_cast<u8>(std::clamp<int>(in[i], 0, activation_max));
+		}
+
+		void dense(const u8* in, const i8* weights, const i32* biases, i32* out, int in_size, int out_size) {
+			for (int o = 0; o < out_size; o++) {
+				i32 sum = biases[o];
+				for (int i = 0; i < in_size; i++) sum += in[i] * weights[o * in_size + i];
+				out[o] = sum;
+			}
+		}
+	}
+
+#ifdef NNUE_X86
+	namespace sse41 {
+		NNUE_TARGET("sse4.1") void add(i16* acc, const i16* column) {
+			for (int i = 0; i < hidden; i += 8) {
+				__m128i* a = reinterpret_cast<__m128i*>(acc + i);
+				_mm_storeu_si128(a, _mm_add_epi16(_mm_loadu_si128(a), _mm_loadu_si128(reinterpret_cast<const __m128i*>(column + i))));
+			}
+		}
+
+		NNUE_TARGET("sse4.1") void sub(i16* acc, const i16* column) {
+			for (int i = 0; i < hidden; i += 8) {
+				__m128i* a = reinterpret_cast<__m128i*>(acc + i);
+				_mm_storeu_si128(a, _mm_sub_epi16(_mm_loadu_si128(a), _mm_loadu_si128(reinterpret_cast<const __m128i*>(column + i))));
+			}
+		}
+
+		NNUE_TARGET("sse4.1") void addSub(i16* acc, const i16* add, const i16* sub) {
+			for (int i = 0; i < hidden; i += 8) {
+				__m128i* a = reinterpret_cast<__m128i*>(acc + i);
+				__m128i delta = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(add + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(sub + i)));
+				_mm_storeu_si128(a, _mm_add_epi16(_mm_loadu_si128(a), delta));
+			}
+		}
+
+		NNUE_TARGET("sse4.1") void activate(const i16* in, u8* out) {
+			const __m128i max = _mm_set1_epi8(activation_max);
+			for (int i = 0; i < hidden; i += 16) {
+				__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+				__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8));
+				//packus clips negatives to 0, the min takes care of the top
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_min_epu8(_mm_packus_epi16(lo, hi), max));
+			}
+		}
+
+		NNUE_TARGET("sse4.1") void dense(const u8* in, const i8* weights, const i32* biases, i32* out, int in_size, int out_size) {
+			const __m128i ones = _mm_set1_epi16(1);
+			for (int o = 0; o < out_size; o++) {
+				__m128i sum = _mm_setzero_si128();
+				for (int i = 0; i < in_size; i += 16) {
+					__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+					__m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + o * in_size + i));
+					sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_maddubs_epi16(x, w), ones));
+				}
+				sum = _mm_hadd_epi32(sum, sum);
+				sum = _mm_hadd_epi32(sum, sum);
+				out[o] = biases[o] + _mm_cvtsi128_si32(sum);
+			}
+		}
+	}
+
+	namespace avx2 {
+		NNUE_TARGET("avx2") void add(i16* acc, const i16* column) {
+			for (int i = 0; i < hidden; i += 16) {
+				__m256i* a = reinterpret_cast<__m256i*>(acc + i);
+				_mm256_storeu_si256(a, _mm256_add_epi16(_mm256_loadu_si256(a), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(column + i))));
+			}
+		}
+
+		NNUE_TARGET("avx2") void sub(i16* acc, const i16* column) {
+			for (int i = 0; i < hidden; i += 16) {
+				__m256i* a = reinterpret_cast<__m256i*>(acc + i);
+				_mm256_storeu_si256(a, _mm256_sub_epi16(_mm256_loadu_si256(a), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(column + i))));
+			}
+		}
+
+		NNUE_TARGET("avx2") void addSub(i16* acc, const i16* add, const i16* sub) {
+			for (int i = 0; i < hidden; i += 16) {
+				__m256i* a = reinterpret_cast<__m256i*>(acc + i);
+				__m256i delta = _mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(add + i)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sub + i)));
+				_mm256_storeu_si256(a, _mm256_add_epi16(_mm256_loadu_si256(a), delta));
+			}
+		}
+
+		NNUE_TARGET("avx2") void activate(const i16* in, u8* out) {
+			const __m256i max = _mm256_set1_epi8(activation_max);
+			for (int i = 0; i < hidden; i += 32) {
+				__m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+				__m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 16));
+				//packus works per 128 bit lane, the permute puts the quarters back in order
+				__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_min_epu8(packed, max));
+			}
+		}
+
+		NNUE_TARGET("avx2") void dense(const u8* in, const i8* weights, const i32* biases, i32* out, int in_size, int out_size) {
+			const __m256i ones = _mm256_set1_epi16(1);
+			for (int o = 0; o < out_size; o++) {
+				__m256i sum = _mm256_setzero_si256();
+				for (int i = 0; i < in_size; i += 32) {
+					__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+					__m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + o * in_size + i));
+					sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(x, w), ones));
+				}
+				__m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+				half = _mm_hadd_epi32(half, half);
+				half = _mm_hadd_epi32(half, half);
+				out[o] = biases[o] + _mm_cvtsi128_si32(half);
+			}
+		}
+	}
+#endif
+
+	constexpr Kernels scalar_kernels = { scalar::add, scalar::sub, scalar::addSub, scalar::activate, scalar::dense };
+#ifdef NNUE_X86
+	constexpr Kernels sse41_kernels = { sse41::add, sse41::sub, sse41::addSub, sse41::activate, sse41::dense };
+	constexpr Kernels avx2_kernels = { avx2::add, avx2::sub, avx2::addSub, avx2::activate, avx2::dense };
+#endif
+
+	Backend current_backend = Backend::scalar;
+	Kernels kernels = scalar_kernels;
+
+	bool cpuSupports(Backend backend) {
+#ifdef NNUE_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+		int info[4];
+		__cpuid(info, 0);
+		const int max_leaf = info[0];
+		__cpuid(info, 1);
+		const bool sse41 = info[2] & (1 << 19);
+		//avx2 also needs the os to save the upper halves of the ymm registers
+		const bool os_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+		bool avx2 = false;
+		if (max_leaf >= 7) {
+			__cpuidex(info, 7, 0);
+			avx2 = os_ymm && (info[1] & (1 << 5));
+		}
+#else
+		__builtin_cpu_init();
+		const bool sse41 = __builtin_cpu_supports("sse4.1");
+		const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+		switch (backend) {
+		case Backend::avx2: return avx2;
+		case Backend::sse41: return sse41;
+		default: return true;
+		}
+#else
+		return backend == Backend::scalar;
+#endif
+	}
+
+	int feature(int perspective, int color, int piece, int square) {
+		if (perspective == eBlack) {
+			color ^= 1;
+			square ^= 56;
+		}
+		return color * 384 + (piece - 1) * 64 + square;
+	}
+
+	const i16* column(int perspective, int color, int piece, int square) {
+		return net->ft_weights.data() + feature(perspective, color, piece, square) * hidden;
+	}
+
+	template <typename T>
+	bool read(std::istream& in, std::vector<T>& values) {
+		in.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+		return static_cast<bool>(in);
+	}
+
+	template <typename T>
+	bool read(std::istream& in, T& value) {
+		in.read(reinterpret_cast<char*>(&value), sizeof(T));
+		return static_cast<bool>(in);
+	}
+}
+
+namespace NNUE {
+	bool load(const std::string& path) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			unload();
+			return false;
+		}
+		return load(file);
+	}
+
+	bool load(std::istream& in) {
+		unload();
+		u32 header[5];
+		for (auto& value : header) {
+			if (!read(in, value)) return false;
+		}
+		if (header[0] != magic || header[1] != version || header[2] != hidden || header[3] != l1_size || header[4] != l2_size) {
+			return false;
+		}
+
+		auto loaded = std::make_unique<Network>();
+		const bool ok =
+			read(in, loaded->ft_biases) && read(in, loaded->ft_weights) &&
+			read(in, loaded->l1_biases) && read(in, loaded->l1_weights) &&
+			read(in, loaded->l2_biases) && read(in, loaded->l2_weights) &&
+			read(in, loaded->output_bias) && read(in, loaded->output_weights);
+		if (!ok) return false;
+
+		net = std::move(loaded);
+		setBackend(supportedBackends().back());
+		return true;
+	}
+
+	void unload() {
+		net.reset();
+	}
+
+	bool isLoaded() {
+		return net != nullptr;
+	}
+
+	std::vector<Backend> supportedBackends() {
+		std::vector<Backend> out;
+		for (Backend backend : { Backend::scalar, Backend::sse41, Backend::avx2 }) {
+			if (cpuSupports(backend)) out.push_back(backend);
+		}
+		return out;
+	}
+
+	void setBackend(Backend backend) {
+		if (!cpuSupports(backend)) backend = Backend::scalar;
+		current_backend = backend;
+		switch (backend) {
+#ifdef NNUE_X86
+		case Backend::avx2: kernels = avx2_kernels; break;
+		case Backend::sse41: kernels = sse41_kernels; break;
+#endif
+		default: kernels = scalar_kernels; break;
+		}
+	}
+
+	Backend getBackend() {
+		return current_backend;
+	}
+
+	std::string backendName(Backend backend) {
+		switch (backend) {
+		case Backend::avx2: return "avx2";
+		case Backend::sse41: return "sse4.1";
+		default: return "scalar";
+		}
+	}
+
+	void clear(Accumulator& acc) {
+		for (auto& values : acc.values) {
+			std::copy(net->ft_biases.begin(), net->ft_biases.end(), values.begin());
+		}
+	}
+
+	void addPiece(Accumulator& acc, int color, int piece, int square) {
+		for (int perspective = eWhite; perspective <= eBlack; perspective++) {
+			kernels.add(acc.values[perspective].data(), column(perspective, color, piece, square));
+		}
+	}
+
+	void removePiece(Accumulator& acc, int color, int piece, int square) {
+		for (int perspective = eWhite; perspective <= eBlack; perspective++) {
+			kernels.sub(acc.values[perspective].data(), column(perspective, color, piece, square));
+		}
+	}
+
+	void movePiece(Accumulator& acc, int color, int piece, int from, int to) {
+		for (int perspective = eWhite; perspective <= eBlack; perspective++) {
+			kernels.addSub(acc.values[perspective].data(), column(perspective, color, piece, to), column(perspective, color, piece, from));
+		}
+	}
+
+	int evaluate(const Accumulator& acc, bool side) {
+		alignas(32) std::array<u8, 2 * hidden> input;
+		alignas(32) std::array<i32, l1_size> l1_out;
+		alignas(32) std::array<u8, l1_size> l1_act;
+		alignas(32) std::array<i32, l2_size> l2_out;
+
+		//side to move first
+		kernels.activate(acc.values[side].data(), input.data());
+		kernels.activate(acc.values[!side].data(), input.data() + hidden);
+
+		kernels.dense(input.data(), net->l1_weights.data(), net->l1_biases.data(), l1_out.data(), 2 * hidden, l1_size);
+		for (int i = 0; i < l1_size; i++) l1_act[i] = static_cast<u8>(std::clamp(l1_out[i] >> weight_shift, 0, activation_max));
+
+		kernels.dense(l1_act.data(), net->l2_weights.data(), net->l2_biases.data(), l2_out.data(), l1_size, l2_size);
+		i32 output = net->output_bias;
+		for (int i = 0; i < l2_size; i++) {
+			output += std::clamp(l2_out[i] >> weight_shift, 0, activation_max) * net->output_weights[i];
+		}
+		return output / output_scale;
+	}
+}
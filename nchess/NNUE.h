@@ -0,0 +1,65 @@
+#pragma once
+#include "Misc.h"
+#include <array>
+#include <istream>
+#include <string>
+#include <vector>
+
+// optional neural network eval, used in place of the hand written one once EvalFile loads a net.
+// (768 -> 256) x2 -> 32 -> 32 -> 1, the feature transform is int16 and the dense layers int8.
+//
+// file layout, little endian:
+//  u32 magic "NCNE", u32 version, u32 hidden, u32 l1 size, u32 l2 size
+//  i16 ft biases[hidden], i16 ft weights[768][hidden]
+//  i32 l1 biases[l1], i8 l1 weights[l1][2 * hidden]
+//  i32 l2 biases[l2], i8 l2 weights[l2][l1]
+//  i32 output bias, i8 output weights[l2]
+// features are color * 384 + (piece - 1) * 64 + square, from the point of view of the
+// accumulator's side, black's squares are flipped vertically
+namespace NNUE {
+	constexpr u32 magic = 0x454E434E;
+	constexpr u32 version = 1;
+	constexpr int features = 768;
+	constexpr int hidden = 256;
+	constexpr int l1_size = 32;
+	constexpr int l2_size = 32;
+	// activations are clipped to [0, activation_max], dense sums are shifted down by weight_shift first
+	constexpr int activation_max = 127;
+	constexpr int weight_shift = 6;
+	// output / output_scale is centipawns
+	constexpr int output_scale = 16;
+
+	// first layer outputs for both perspectives, indexed by color
+	struct alignas(32) Accumulator {
+		std::array<std::array<i16, hidden>, 2> values;
+
+		bool operator==(const Accumulator&) const = default;
+	};
+
+	enum class Backend : u8 {
+		scalar,
+		sse41,
+		avx2
+	};
+
+	// replaces the current net, false and no net if the file is missing or doesn't match the layout
+	bool load(const std::string& path);
+	bool load(std::istream& in);
+	void unload();
+	[[nodiscard]] bool isLoaded();
+
+	// load() picks the best backend the cpu supports, setBackend is only there to compare them
+	[[nodiscard]] std::vector<Backend> supportedBackends();
+	void setBackend(Backend backend);
+	[[nodiscard]] Backend getBackend();
+	[[nodiscard]] std::string backendName(Backend backend);
+
+	// resets to the biases, pieces are added on top
+	void clear(Accumulator& acc);
+	void addPiece(Accumulator& acc, int color, int piece, int square);
+	void removePiece(Accumulator& acc, int color, int piece, int square);
+	void movePiece(Accumulator& acc, int color, int piece, int from, int to);
+
+	// from side's point of view
+	[[nodiscard]] int evaluate(const Accumulator& acc, bool side);
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "Misc.h"
+#include <array>
+#include <algorithm>
+#include <vector>
+
+// everything the eval derives from the pawns alone, keyed by Board's pawn hash
+struct PawnEntry {
+	u64 key = 0;
+	// packed S() score from white's view
+	int score = 0;
+	std::array<u64, 2> passed = {};
+	// every square a side's pawns attack now or could attack after pushing
+	std::array<u64, 2> attack_spans = {};
+};
+
+// one per search thread, so no locking. an empty slot has key 0, which is also the key of a
+// position without pawns, and the zeroed entry is the right answer there
+class PawnTable
+{
+private:
+	static constexpr usize size = 1 << 14;
+	std::vector<PawnEntry> entries;
+
+public:
+	PawnTable() : entries(size) {}
+
+	[[nodiscard]] PawnEntry& getEntry(u64 pawn_hash) {
+		return entries[pawn_hash & (size - 1)];
+	}
+
+	void clear() {
+		std::fill(entries.begin(), entries.end(), PawnEntry{});
+	}
+};
@@ -0,0 +1,87 @@
+#include "TranspositionTable.h"
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+#if defined(_WIN32)
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace {
+	constexpr usize huge_page_size = 2 * 1024 * 1024;
+
+	// large tables are backed by 2MB pages where the os allows it to cut down on tlb misses
+	void* allocTable(usize size) {
+#if defined(_WIN32)
+		return _aligned_malloc(size, sizeof(TTBucket));
+#elif defined(__linux__)
+		void* mem = std::aligned_alloc(huge_page_size, size);
+		if (mem) madvise(mem, size, MADV_HUGEPAGE);
+		return mem;
+#else
+		return std::aligned_alloc(sizeof(TTBucket), size);
+#endif
+	}
+
+	void freeTable(void* mem) {
+#if defined(_WIN32)
+		_aligned_free(mem);
+#else
+		std::free(mem);
+#endif
+	}
+}
+
+TranspositionTable::~TranspositionTable() {
+	freeTable(buckets);
+}
+
+void TranspositionTable::resize(usize megabytes) {
+	u64 requested = std::max<u64>(1, megabytes * 1024 * 1024 / sizeof(TTBucket));
+	//aligned_alloc wants a multiple of the alignment
+	usize size = (requested * sizeof(TTBucket) + huge_page_size - 1) / huge_page_size * huge_page_size;
+	//the old table stays in place if the new one can't be had
+	TTBucket* table = static_cast<TTBucket*>(allocTable(size));
+	if (!table) {
+		throw std::bad_alloc();
+	}
+	freeTable(buckets);
+	buckets = table;
+	alloc_size = size;
+	num_buckets = requested;
+	clear();
+}
+
+void TranspositionTable::clear() {
+	const u64 num_threads = std::max(1u, std::thread::hardware_concurrency());
+	const u64 chunk = (num_buckets + num_threads - 1) / num_threads;
+
+	std::vector<std::thread> threads;
+	for (u64 i = 0; i < num_threads; i++) {
+		u64 begin = std::min(num_buckets, i * chunk);
+		u64 end = std::min(num_buckets, begin + chunk);
+		if (begin == end) break;
+		threads.emplace_back([this, begin, end] {
+			std::uninitialized_value_construct(buckets + begin, buckets + end);
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	current_generation = 0;
+}
+
+int TranspositionTable::hashfull() const {
+	const u64 sample = std::min<u64>(num_buckets, 1000 / TTBucket::size);
+	if (!sample) return 0;
+	int used = 0;
+	for (u64 i = 0; i < sample; i++) {
+		for (auto& slot : buckets[i].data) {
+			u64 data = slot.load(std::memory_order_relaxed);
+			used += ((data >> 56) & 0x3) && (data >> 58) == getGeneration();
+		}
+	}
+	return static_cast<int>(used * 1000 / (sample * TTBucket::size));
+}
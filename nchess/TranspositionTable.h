@@ -0,0 +1,271 @@
+#pragma once
+#include "Misc.h"
+#include "Move.h"
+#include <array>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <cstdlib>
+#include <xmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// high 64 bits of the 128 bit product, maps a key onto [0, b) without a modulo
+inline u64 mulHi64(u64 a, u64 b) {
+#if defined(_MSC_VER) && !defined(__clang__)
+	return __umulh(a, b);
+#else
+	return static_cast<u64>((static_cast<unsigned __int128>(a) * b) >> 64);
+#endif
+}
+
+enum class TType : u8 {
+	INVALID,
+	EXACT,
+	FAIL_LOW,
+	BETA_CUT
+};
+
+// unpacked copy of a table slot, handed out by probe()
+struct TTEntry {
+	// static_eval of a node that never evaluated, e.g. one in check
+	static constexpr int no_eval = std::numeric_limits<i16>::min();
+
+	int eval = 0;
+	int static_eval = no_eval;
+	u8 depth_left = 0;
+	u8 generation = 0;
+	TType type = TType::INVALID;
+	u16 best_move = 0; // Move::compact()
+
+	[[nodiscard]] explicit constexpr operator bool() const {
+		return type != TType::INVALID;
+	}
+};
+
+// every entry is an 8 byte data word plus a 16 bit check, the key fragment xored with the data
+// folded down to 16 bits. threads read and write both without locks, an entry caught halfway
+// through someone else's write fails the check just like a different key would
+//data bits 0-15: best move
+//bits 16-31: score
+//bits 32-47: static eval
+//bits 48-55: depth left
+//bits 56-57: bound type
+//bits 58-63: generation
+struct alignas(64) TTBucket {
+	static constexpr int size = 6;
+	std::array<std::atomic<u64>, size> data;
+	std::array<std::atomic<u16>, size> checks;
+};
+static_assert(sizeof(TTBucket) == 64);
+
+class TranspositionTable
+{
+private:
+	TTBucket* buckets = nullptr;
+	u64 num_buckets = 0;
+	usize alloc_size = 0;
+	std::atomic<u8> current_generation = 0;
+	// how much shallower a non exact store may be than the entry it overwrites for the same position
+	static constexpr int same_key_margin = 2;
+
+	[[nodiscard]] TTBucket& getBucket(u64 hash_key) const {
+		return buckets[mulHi64(hash_key, num_buckets)];
+	}
+
+	// mate scores sit close to +-100000, fold them into the top of the int16 range
+	static i16 packScore(int score) {
+		if (std::abs(score) > 99000) {
+			int mate = 32767 - std::min(100000 - std::abs(score), 767);
+			return static_cast<i16>(score > 0 ? mate : -mate);
+		}
+		return static_cast<i16>(std::clamp(score, -32000, 32000));
+	}
+
+	static int unpackScore(i16 packed) {
+		if (std::abs(packed) > 32000) {
+			int score = 100000 - (32767 - std::abs(packed));
+			return packed > 0 ? score : -score;
+		}
+		return packed;
+	}
+
+	static u16 checkOf(u64 hash_key, u64 data) {
+		return static_cast<u16>(hash_key ^ data ^ (data >> 16) ^ (data >> 32) ^ (data >> 48));
+	}
+
+	static i16 packEval(int static_eval) {
+		if (static_eval == TTEntry::no_eval) return TTEntry::no_eval;
+		return static_cast<i16>(std::clamp(static_eval, -32000, 32000));
+	}
+
+	static u64 pack(int score, int static_eval, TType type, u8 depth_left, u16 best_move, u8 generation) {
+		return u64(best_move)
+			| (u64(static_cast<u16>(packScore(score))) << 16)
+			| (u64(static_cast<u16>(packEval(static_eval))) << 32)
+			| (u64(depth_left) << 48)
+			| (u64(type) << 56)
+			| (u64(generation & 0x3F) << 58);
+	}
+
+	static TTEntry unpack(u64 data) {
+		TTEntry entry;
+		entry.best_move = static_cast<u16>(data);
+		entry.eval = unpackScore(static_cast<i16>(data >> 16));
+		entry.static_eval = static_cast<i16>(data >> 32);
+		entry.depth_left = static_cast<u8>(data >> 48);
+		entry.type = static_cast<TType>((data >> 56) & 0x3);
+		entry.generation = static_cast<u8>(data >> 58);
+		return entry;
+	}
+
+public:
+	TranspositionTable() = default;
+	TranspositionTable(const TranspositionTable&) = delete;
+	TranspositionTable& operator=(const TranspositionTable&) = delete;
+	~TranspositionTable();
+
+	void resize(usize megabytes);
+	// zeroes the table, split over all hardware threads
+	void clear();
+
+	void nextGeneration() {
+		current_generation.store((current_generation.load(std::memory_order_relaxed) + 1) & 0x3F, std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] u8 getGeneration() const {
+		return current_generation.load(std::memory_order_relaxed);
+	}
+
+	// permille of the slots written by the current search, from a sample at the start of the table
+	[[nodiscard]] int hashfull() const;
+
+	// pulls the bucket into cache ahead of the probe, the search issues it before making the move
+	void prefetch(u64 hash_key) const {
+		_mm_prefetch(reinterpret_cast<const char*>(&getBucket(hash_key)), _MM_HINT_T0);
+	}
+
+	[[nodiscard]] TTEntry probe(u64 hash_key) const {
+		TTBucket& bucket = getBucket(hash_key);
+		for (int i = 0; i < TTBucket::size; i++) {
+			u64 data = bucket.data[i].load(std::memory_order_relaxed);
+			if (bucket.checks[i].load(std::memory_order_relaxed) == checkOf(hash_key, data) && ((data >> 56) & 0x3)) {
+				return unpack(data);
+			}
+		}
+		return TTEntry{};
+	}
+
+	void store(u64 hash_key, int score, int static_eval, TType type, u8 depth_left, u16 best_move) {
+		TTBucket& bucket = getBucket(hash_key);
+		int replace = 0;
+		int worst = std::numeric_limits<int>::max();
+
+		for (int i = 0; i < TTBucket::size; i++) {
+			u64 data = bucket.data[i].load(std::memory_order_relaxed);
+			if (!((data >> 56) & 0x3)) {
+				replace = i;
+				break;
+			}
+			if (bucket.checks[i].load(std::memory_order_relaxed) == checkOf(hash_key, data)) {
+				//a shallower bound from this search doesn't get to throw away a deeper result,
+				//the old entry just picks up the new move
+				const int old_depth = static_cast<int>((data >> 48) & 0xFF);
+				if (type != TType::EXACT && depth_left + same_key_margin < old_depth && (data >> 58) == getGeneration()) {
+					if (best_move && best_move != static_cast<u16>(data)) {
+						const u64 refreshed = (data & ~0xFFFFull) | best_move;
+						bucket.data[i].store(refreshed, std::memory_order_relaxed);
+						bucket.checks[i].store(checkOf(hash_key, refreshed), std::memory_order_relaxed);
+					}
+					return;
+				}
+				// keep the old move and static eval if this search didn't produce them
+				if (!best_move) best_move = static_cast<u16>(data);
+				if (static_eval == TTEntry::no_eval) static_eval = static_cast<i16>(data >> 32);
+				replace = i;
+				break;
+			}
+
+			//prefer overwriting shallow entries from older generations
+			int age = (getGeneration() - static_cast<int>(data >> 58)) & 0x3F;
+			int value = static_cast<int>((data >> 48) & 0xFF) - 8 * age;
+			if (value < worst) {
+				worst = value;
+				replace = i;
+			}
+		}
+		const u64 data = pack(score, static_eval, type, depth_left, best_move, getGeneration());
+		bucket.data[replace].store(data, std::memory_order_relaxed);
+		bucket.checks[replace].store(checkOf(hash_key, data), std::memory_order_relaxed);
+	}
+};
+
+// static evals by zobrist key, shared by all threads. a slot is one word, the upper 48 bits of
+// the key with the eval underneath, so it can't be torn either
+class EvalCache
+{
+private:
+	static constexpr usize size = 1 << 16;
+	std::unique_ptr<std::atomic<u64>[]> slots = std::make_unique<std::atomic<u64>[]>(size);
+
+public:
+	[[nodiscard]] bool probe(u64 hash_key, int& eval) const {
+		u64 data = slots[hash_key & (size - 1)].load(std::memory_order_relaxed);
+		if (!data || ((data ^ hash_key) & ~0xFFFFull)) return false;
+		eval = static_cast<i16>(data);
+		return true;
+	}
+
+	void store(u64 hash_key, int eval) {
+		u64 data = (hash_key & ~0xFFFFull) | static_cast<u16>(std::clamp(eval, -32000, 32000));
+		slots[hash_key & (size - 1)].store(data, std::memory_order_relaxed);
+	}
+
+	void clear() {
+		for (usize i = 0; i < size; i++) {
+			slots[i].store(0, std::memory_order_relaxed);
+		}
+	}
+};
+
+// subtree leaf counts for perft, by zobrist key and remaining depth. shared by the perft threads.
+// a wrong count can't be tolerated here, so every slot keeps the full key xored with its data,
+// the count stored above the depth
+struct PerftSlot {
+	std::atomic<u64> key;
+	std::atomic<u64> data;
+};
+
+class PerftTable
+{
+private:
+	usize size;
+	std::unique_ptr<PerftSlot[]> slots;
+
+	[[nodiscard]] PerftSlot& getSlot(u64 hash_key, int depth) const {
+		return slots[(hash_key ^ (u64(depth) * 0x9E3779B97F4A7C15)) & (size - 1)];
+	}
+
+public:
+	explicit PerftTable(usize megabytes)
+		: size(std::bit_floor(std::max<usize>(1, megabytes * 1024 * 1024 / sizeof(PerftSlot)))),
+		slots(std::make_unique<PerftSlot[]>(size)) {}
+
+	[[nodiscard]] bool probe(u64 hash_key, int depth, u64& count) const {
+		PerftSlot& slot = getSlot(hash_key, depth);
+		u64 data = slot.data.load(std::memory_order_relaxed);
+		if ((slot.key.load(std::memory_order_relaxed) ^ data) != hash_key || (data & 0xFF) != u64(depth)) return false;
+		count = data >> 8;
+		return true;
+	}
+
+	void store(u64 hash_key, int depth, u64 count) {
+		PerftSlot& slot = getSlot(hash_key, depth);
+		const u64 data = (count << 8) | u64(depth);
+		slot.key.store(hash_key ^ data, std::memory_order_relaxed);
+		slot.data.store(data, std::memory_order_relaxed);
+	}
+};
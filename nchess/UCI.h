@@ -3,12 +3,18 @@
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <new>
 #include <vector>
 #include <algorithm>
 #include "Engine.h"
+#include "Bench.h"
 #include <signal.h>
 #include <conio.h>
 #include <mutex>
+#include <atomic>
+#include <chrono>
 
 //#include "../nchess/imgui/imgui.h"
 
@@ -22,11 +28,11 @@ public:
         : debug_mode_(false)
     {
         instance = this;
-        engine_ = Engine();
     }
 
     void setupBoard(std::istringstream& iss) {
         std::string token;
+        engine_.waitForSearch();
         engine_.b.reset();
         iss >> token;
         if (token == "fen") {
@@ -51,15 +57,17 @@ public:
             }
             else if (token == "isready")
             {
-                std::cout << "readyok" << std::endl;
+                syncPrint("readyok");
             }
             else if (token == "setoption")
             {
-                // Option parsing can be implemented here
+                engine_.waitForSearch();
+                handleSetOption(iss);
             }
             else if (token == "ucinewgame")
             {
-                engine_ = Engine();
+                engine_.waitForSearch();
+                engine_.newGame();
             }
             else if (token == "position")
             {
@@ -71,11 +79,16 @@ public:
             }
             else if (token == "stop")
             {
-                // Not implemented: should stop search
+                stop_requested_at = std::chrono::steady_clock::now().time_since_epoch().count();
+                engine_.stopSearch();
+            }
+            else if (token == "ponderhit")
+            {
+                engine_.ponderHit();
             }
             else if (token == "quit")
             {
-                //nothing
+                break;
             }
             else if (token == "debug")
             {
@@ -83,6 +96,16 @@ public:
                 iss >> mode;
                 debug_mode_ = (mode == "on");
             }
+            else if (token == "bench")
+            {
+                engine_.waitForSearch();
+                bench(iss);
+            }
+            else if (token == "perft")
+            {
+                engine_.waitForSearch();
+                perft(iss);
+            }
             else if (token == "test")
             {
 
@@ -104,6 +127,7 @@ Moves; f6e4 d1d5 f7f5 f1c4 d8e7 e1g1 c6b4 d5d1 b4c6 b1c3 c6e5 c3d5 e5f3 d1f3 e7c
 
 
                 //std::istringstream test("fen rn1qkb1r/ppp1ppp1/7p/3p4/6bB/2P2N2/PPP1QPPP/R3KB1R b KQkq - 1 7 moves b8c6 e1c1 a8c8 c1b1 g7g5 h4g3 f8g7 h2h3 g4h5 h3h4 e7e5 h4g5 h6g5 h1h5 h8h5 f3e5 g7e5 e2h5 e5g3 f2g3 d8f6 f1b5 f6e5 d1f1 e5e7 h5h1 e8d7 h1h3 d7d8 h3f5 e7e6 f5f7 e6f7 f1f7 a7a6 b5c6 b7c6 f7g7 d8e8 a2a3 e8f8 g7g5 c8e8 g5f5 f8g7 f5g5 g7f6 g5g4 e8e1 b1a2 a6a5 g4f4 f6g7 f4g4 g7h7 g4f4 h7g7 c3c4 e1e2 c4d5 c6d5 c2c4 c7c6 c4d5 c6d5 f4f5 e2d2 a3a4 d2d3 g3g4 d3d4 a2b1 d4a4 f5d5 a4g4 d5a5 g4g2 a5a7 g7g6 a7d7 g2e2 b1c1 e2e4 c1b1 g6f5 d7f7 f5g4 f7g7 g4f3 g7f7 f3g4 b1c2 e4e2 c2c3 g4g3 b2b4 e2e1 b4b5 e1b1 c3c4 b1b2 c4c5 b2c2 c5b6 c2b2 f7d7 b2b1 d7g7 g3f3 g7f7 f3g3 f7g7 g3f3 b6c6 b1b2 b5b6 b2c2 c6d5 c2d2 d5c4 d2c2 c4d3 c2a2 b6b7 a2b2 g7f7 f3g3 d3c3 b2b5 f7g7 g3f4 g7c7 f4f3 ");
+                engine_.waitForSearch();
                 engine_.tc.winc = 100000000;
                 engine_.tc.binc = 100000000;
                 setupBoard(test);
@@ -114,7 +138,7 @@ Moves; f6e4 d1d5 f7f5 f1c4 d8e7 e1g1 c6b4 d5d1 b4c6 b1c3 c6e5 c3d5 e5f3 d1f3 e7c
 
                 while (true) {
                     for (auto& position : pos_list) {
-                        engine_ = Engine();
+                        engine_.newGame();
                         std::istringstream ss(position);
                         setupBoard(ss);
                         std::istringstream go_ss("go movetime 1000");
@@ -128,6 +152,122 @@ Moves; f6e4 d1d5 f7f5 f1c4 d8e7 e1g1 c6b4 d5d1 b4c6 b1c3 c6e5 c3d5 e5f3 d1f3 e7c
             }
             // Add more UCI commands as needed
         }
+        engine_.stopSearch();
+        engine_.waitForSearch();
+    }
+
+    // perft [depth] [stats]
+    // counts the leaves below the current position with the fast bulk counting perft on Threads threads.
+    // stats switches to the slow single threaded one that also counts captures, checks, mates and so on
+    void perft(std::istringstream& iss)
+    {
+        int depth = 1;
+        std::string mode;
+        iss >> depth >> mode;
+        if (mode != "stats") {
+            engine_.perft(depth);
+            return;
+        }
+        for (auto& values : engine_.doPerftSearch(depth)) {
+            syncPrint(values.to_string());
+        }
+    }
+
+    // bench [depth] [threads] [hash]
+    // searches every bench position to a fixed depth from a cleared state, the total node count
+    // is a signature of the search and only changes when the search itself does (with one thread).
+    // with a net loaded this runs once per nnue backend the cpu supports, they should all agree
+    void bench(std::istringstream& iss)
+    {
+        int depth = 7;
+        int threads = 1;
+        usize hash_mb = 16;
+        std::string token;
+        try {
+            if (iss >> token) depth = std::max(1, std::stoi(token));
+            if (iss >> token) threads = std::clamp(std::stoi(token), 1, 256);
+            if (iss >> token) hash_mb = std::clamp<usize>(std::stoull(token), 1, 131072);
+        }
+        catch (const std::logic_error&) {
+            syncPrint("info string invalid bench argument " + token + ", usage: bench [depth] [threads] [hash]");
+            return;
+        }
+
+        //bench settings are its own, the gui's Hash and Threads come back afterwards
+        const usize previous_hash_mb = engine_.getHashSize();
+        const int previous_threads = engine_.getThreads();
+        if (!trySetHashSize(hash_mb)) return;
+        engine_.setThreads(threads);
+
+        if (!NNUE::isLoaded()) {
+            benchSearch(depth);
+        }
+        else {
+            const NNUE::Backend best_backend = NNUE::getBackend();
+            for (NNUE::Backend backend : NNUE::supportedBackends()) {
+                NNUE::setBackend(backend);
+                syncPrint("NNUE backend    : " + NNUE::backendName(backend));
+                benchEval();
+                benchSearch(depth);
+            }
+            NNUE::setBackend(best_backend);
+        }
+
+        trySetHashSize(previous_hash_mb);
+        engine_.setThreads(previous_threads);
+    }
+
+    void benchSearch(int depth)
+    {
+        u64 total_nodes = 0;
+        u64 tt_probes = 0;
+        u64 tt_hits = 0;
+        i64 total_ms = 0;
+        for (usize i = 0; i < bench_positions.size(); i++) {
+            syncPrint("Position: " + std::to_string(i + 1) + "/" + std::to_string(bench_positions.size()) + " " + bench_positions[i]);
+            engine_.newGame();
+            std::istringstream fen(bench_positions[i]);
+            engine_.setBoardFEN(fen);
+            engine_.tc = TimeControl();
+
+            auto start = std::chrono::steady_clock::now();
+            engine_.startSearch(depth, [](Move, Move) {});
+            engine_.waitForSearch();
+            total_ms += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            total_nodes += engine_.getNodes();
+            tt_probes += engine_.getTTProbes();
+            tt_hits += engine_.getTTHits();
+        }
+
+        syncPrint("===========================");
+        syncPrint("Total time (ms) : " + std::to_string(total_ms));
+        syncPrint("Nodes searched  : " + std::to_string(total_nodes));
+        syncPrint("Nodes/second    : " + std::to_string(total_nodes * 1000 / std::max<i64>(1, total_ms)));
+        std::ostringstream hit_rate;
+        hit_rate << "info string tt hit rate " << std::fixed << std::setprecision(1) << (tt_probes ? 100.0 * tt_hits / tt_probes : 0.0) << "%";
+        syncPrint(hit_rate.str());
+    }
+
+    // static evals of the bench positions in a loop, the accumulators are only built once
+    void benchEval()
+    {
+        constexpr int rounds = 2000;
+        std::vector<Board> boards(bench_positions.size());
+        for (usize i = 0; i < bench_positions.size(); i++) {
+            std::istringstream fen(bench_positions[i]);
+            boards[i].loadFen(fen);
+            boards[i].refreshAccumulator();
+        }
+
+        i64 checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; round++) {
+            for (const auto& board : boards) checksum += board.getEval();
+        }
+        i64 total_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+        syncPrint("Eval checksum   : " + std::to_string(checksum));
+        syncPrint("Evals/second    : " + std::to_string(u64(rounds) * boards.size() * 1000000 / std::max<i64>(1, total_us)));
     }
 
     void getEngineUpdate() {
@@ -160,7 +300,9 @@ protected:
 private:
     
     Engine engine_;
-    bool debug_mode_;
+    std::atomic<bool> debug_mode_;
+    // steady clock timestamp of the last stop command, used to report stop -> bestmove latency
+    std::atomic<i64> stop_requested_at = 0;
 
     void sendId()
     {
@@ -170,7 +312,82 @@ private:
 
     void sendOptions()
     {
-        // Example: std::cout << "option name Hash type spin default 16 min 1 max 128" << std::endl;
+        std::cout << "option name Hash type spin default 32 min 1 max 131072" << std::endl;
+        std::cout << "option name Clear Hash type button" << std::endl;
+        std::cout << "option name Ponder type check default false" << std::endl;
+        std::cout << "option name MultiPV type spin default 1 min 1 max 256" << std::endl;
+        std::cout << "option name Threads type spin default 1 min 1 max 256" << std::endl;
+        std::cout << "option name Move Overhead type spin default 10 min 0 max 5000" << std::endl;
+        std::cout << "option name EvalFile type string default <empty>" << std::endl;
+    }
+
+    // resize fails without touching the old table, which then stays in use
+    bool trySetHashSize(usize megabytes)
+    {
+        try {
+            engine_.setHashSize(megabytes);
+            return true;
+        }
+        catch (const std::bad_alloc&) {
+            syncPrint("info string could not allocate " + std::to_string(megabytes) + " MB for the hash table, keeping "
+                + std::to_string(engine_.getHashSize()) + " MB");
+            return false;
+        }
+    }
+
+    // setoption name <id> [value <x>], option names may contain spaces
+    void handleSetOption(std::istringstream& iss)
+    {
+        std::string token, name, value;
+        iss >> token;
+        if (token != "name") return;
+        while (iss >> token && token != "value") {
+            name += (name.empty() ? "" : " ") + token;
+        }
+        while (iss >> token) {
+            value += (value.empty() ? "" : " ") + token;
+        }
+
+        //a value that isn't a number is reported and ignored, the option keeps its old setting
+        try {
+            setOption(name, value);
+        }
+        catch (const std::logic_error&) {
+            syncPrint("info string invalid value " + value + " for option " + name);
+        }
+    }
+
+    void setOption(const std::string& name, const std::string& value)
+    {
+        if (name == "Hash") {
+            trySetHashSize(std::clamp<usize>(std::stoull(value), 1, 131072));
+        }
+        else if (name == "Clear Hash") {
+            engine_.clearHash();
+        }
+        else if (name == "MultiPV") {
+            engine_.setMultiPV(std::clamp(std::stoi(value), 1, 256));
+        }
+        else if (name == "Threads") {
+            engine_.setThreads(std::clamp(std::stoi(value), 1, 256));
+        }
+        else if (name == "Move Overhead") {
+            engine_.setMoveOverhead(std::clamp(std::stoi(value), 0, 5000));
+        }
+        else if (name == "EvalFile") {
+            if (value.empty() || value == "<empty>") {
+                NNUE::unload();
+                syncPrint("info string using the hand written eval");
+            }
+            else if (NNUE::load(value)) {
+                syncPrint("info string loaded " + value + " using " + NNUE::backendName(NNUE::getBackend()) + " kernels");
+            }
+            else {
+                syncPrint("info string failed to load " + value + ", using the hand written eval");
+            }
+            //cached static evals came from the other eval
+            engine_.clearHash();
+        }
     }
 
 
@@ -187,13 +404,36 @@ private:
             if (token == "binc") iss >> tc.binc;
             if (token == "depth") iss >> depth;
             if (token == "movetime") iss >> tc.movetime;
+            if (token == "movestogo") iss >> tc.movestogo;
+            if (token == "nodes") iss >> tc.nodes;
+            if (token == "mate") iss >> tc.mate;
+            if (token == "infinite") tc.infinite = true;
+            if (token == "ponder") tc.ponder = true;
+            if (token == "searchmoves") {
+                //searchmoves runs to the end of the line
+                while (iss >> token) tc.searchmoves.push_back(token);
+            }
         }
+        engine_.waitForSearch();
         engine_.tc = tc;
-        Move best_move = engine_.search(depth > 0 ? depth : 7);
-        
-
-    	std::cout << "bestmove " << best_move.toUci() << std::endl;
-
+        stop_requested_at = 0;
+        engine_.startSearch(depth, [this](Move best_move, Move ponder_move) {
+            //reported ahead of bestmove, a gui may stop reading the search output there
+            i64 stop_time = stop_requested_at.exchange(0);
+            if (stop_time) {
+                auto latency = std::chrono::steady_clock::now().time_since_epoch().count() - stop_time;
+                syncPrint("info string stop latency "
+                    + std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::duration(latency)).count())
+                    + " us");
+            }
+            //the helpers are joined by now, their counters can be read
+            if (debug_mode_) {
+                std::ostringstream hit_rate;
+                hit_rate << "info string tt hit rate " << std::fixed << std::setprecision(1) << engine_.getTTHitRate() << "%";
+                syncPrint(hit_rate.str());
+            }
+            syncPrint("bestmove " + (best_move ? best_move.toUci() : "0000") + (ponder_move ? " ponder " + ponder_move.toUci() : ""));
+        });
     }
 };
 
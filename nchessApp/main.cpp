@@ -31,12 +31,21 @@ static void glfw_error_callback(int error, const char* description)
     fprintf(stderr, "GLFW Error %d: %s\n", error, description);
 }
 
-int main()
+int main(int argc, char* argv[])
 {
     BB::init();
-    while (true) {
-        UCI::getInstance()->loop();
+    //nchess bench [depth] [threads] [hash] runs the benchmark and exits
+    if (argc > 1 && std::string(argv[1]) == "bench") {
+        std::string args;
+        for (int i = 2; i < argc; i++) {
+            args += std::string(argv[i]) + " ";
+        }
+        std::istringstream iss(args);
+        UCI::getInstance()->bench(iss);
+        return 0;
     }
+    UCI::getInstance()->loop();
+    return 0;
 
     std::thread t(&UCI::loop, UCI::getInstance());
     /*